@@ -0,0 +1,265 @@
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <thread>
+#include <float.h>
+
+#include "bvh.h"
+
+// Objects per leaf
+static const uint32_t MaxLeafSize = 4;
+
+// Subtrees with at least this many objects are built on a separate thread
+static const uint32_t ParallelThreshold = 8192;
+
+aabb aabb::empty(){
+	aabb box;
+	box.min = vmath::vec3(FLT_MAX, FLT_MAX, FLT_MAX);
+	box.max = vmath::vec3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+	return box;
+}
+
+void aabb::expand(const vmath::vec3& p){
+	for (int i = 0; i < 3; i++){
+		min[i] = std::min(min[i], p[i]);
+		max[i] = std::max(max[i], p[i]);
+	}
+}
+
+void aabb::expand(const aabb& box){
+	for (int i = 0; i < 3; i++){
+		min[i] = std::min(min[i], box.min[i]);
+		max[i] = std::max(max[i], box.max[i]);
+	}
+}
+
+vmath::vec3 aabb::center() const {
+	return vmath::vec3((min[0] + max[0]) * 0.5f, (min[1] + max[1]) * 0.5f, (min[2] + max[2]) * 0.5f);
+}
+
+vmath::vec3 aabb::extents() const {
+	return vmath::vec3((max[0] - min[0]) * 0.5f, (max[1] - min[1]) * 0.5f, (max[2] - min[2]) * 0.5f);
+}
+
+aabb compute_bounds(const vmath::vec4* points, size_t count){
+	aabb box = aabb::empty();
+	for (size_t i = 0; i < count; i++){
+		box.expand(vmath::vec3(points[i][0], points[i][1], points[i][2]));
+	}
+	return box;
+}
+
+aabb transform_bounds(const vmath::affine& m, const aabb& box){
+	// Transform the center, and grow the extents by the absolute value of the linear part
+	vmath::vec3 c = m * box.center();
+	vmath::vec3 e = box.extents();
+	aabb result;
+
+	for (int i = 0; i < 3; i++){
+		float r = fabsf(m[i][0]) * e[0] + fabsf(m[i][1]) * e[1] + fabsf(m[i][2]) * e[2];
+		result.min[i] = c[i] - r;
+		result.max[i] = c[i] + r;
+	}
+	return result;
+}
+
+view_frustum view_frustum::from_matrix(const vmath::mat4& m){
+	view_frustum f;
+
+	// Row i of the matrix is (m[0][i], m[1][i], m[2][i], m[3][i]); each plane is row 3 +/- row 0, 1 or 2
+	for (int p = 0; p < 6; p++){
+		int row = p / 2;
+		float sign = (p % 2 == 0) ? 1.0f : -1.0f;
+		f.a[p] = m[0][3] + sign * m[0][row];
+		f.b[p] = m[1][3] + sign * m[1][row];
+		f.c[p] = m[2][3] + sign * m[2][row];
+		f.d[p] = m[3][3] + sign * m[3][row];
+	}
+
+	// Padding planes that every box is inside of
+	for (int p = 6; p < NumPlanes; p++){
+		f.a[p] = f.b[p] = f.c[p] = 0.0f;
+		f.d[p] = 1.0f;
+	}
+	return f;
+}
+
+cull_result test_bounds(const view_frustum& f, const aabb& box){
+	vmath::vec3 c = box.center();
+	vmath::vec3 e = box.extents();
+	bool inside = true;
+
+#ifdef VMATH_SIMD
+	using namespace vmath::simd;
+	const float4 cx = splat(c[0]), cy = splat(c[1]), cz = splat(c[2]);
+	const float4 ex = splat(e[0]), ey = splat(e[1]), ez = splat(e[2]);
+
+	// Four planes at a time: distance of the center and projected radius of the box
+	for (int p = 0; p < view_frustum::NumPlanes; p += 4){
+		const float4 a = load(f.a + p), b = load(f.b + p), pc = load(f.c + p);
+		float4 dist = madd(madd(madd(load(f.d + p), a, cx), b, cy), pc, cz);
+		float4 radius = madd(madd(mul(abs(a), ex), abs(b), ey), abs(pc), ez);
+
+		if (any_negative(add(dist, radius))){
+			return Outside;
+		}
+		if (any_negative(sub(dist, radius))){
+			inside = false;
+		}
+	}
+#else
+	for (int p = 0; p < view_frustum::NumPlanes; p++){
+		float dist = f.a[p] * c[0] + f.b[p] * c[1] + f.c[p] * c[2] + f.d[p];
+		float radius = fabsf(f.a[p]) * e[0] + fabsf(f.b[p]) * e[1] + fabsf(f.c[p]) * e[2];
+
+		if (dist + radius < 0.0f){
+			return Outside;
+		}
+		if (dist - radius < 0.0f){
+			inside = false;
+		}
+	}
+#endif
+
+	return inside ? Inside : Intersecting;
+}
+
+void bvh::build(const std::vector<aabb>& bounds){
+	uint32_t count = bounds.size();
+
+	nodes.clear();
+	indices.resize(count);
+	leaf_of.assign(count, 0);
+	for (uint32_t i = 0; i < count; i++){
+		indices[i] = i;
+	}
+	if (count == 0){
+		return;
+	}
+
+	// A binary tree with at least one object per leaf has at most 2n - 1 nodes
+	nodes.resize(2 * count - 1);
+	nodes[0].first = 0;
+	nodes[0].count = count;
+	nodes[0].parent = 0;
+
+	std::atomic<uint32_t> next_node(1);
+	unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+	build_node(0, bounds, &next_node, threads);
+	nodes.resize(next_node.load());
+}
+
+void bvh::build_node(uint32_t n, const std::vector<aabb>& bounds, std::atomic<uint32_t>* next_node, unsigned threads){
+	node& nd = nodes[n];
+	uint32_t* first = &indices[nd.first];
+	uint32_t* last = first + nd.count;
+
+	// Bounds of the node and of the object centers
+	aabb centers = aabb::empty();
+	nd.bounds = aabb::empty();
+	for (uint32_t* i = first; i != last; i++){
+		nd.bounds.expand(bounds[*i]);
+		centers.expand(bounds[*i].center());
+	}
+
+	// Split at the median center along the longest axis
+	vmath::vec3 size = centers.max - centers.min;
+	int axis = (size[0] > size[1] && size[0] > size[2]) ? 0 : (size[1] > size[2] ? 1 : 2);
+
+	if (nd.count <= MaxLeafSize || size[axis] <= 0.0f){
+		nd.left = 0;
+		for (uint32_t* i = first; i != last; i++){
+			leaf_of[*i] = n;
+		}
+		return;
+	}
+
+	uint32_t half = nd.count / 2;
+	std::nth_element(first, first + half, last, [&](uint32_t x, uint32_t y){
+		return bounds[x].min[axis] + bounds[x].max[axis] < bounds[y].min[axis] + bounds[y].max[axis];
+	});
+
+	uint32_t left = next_node->fetch_add(2);
+	nodes[left].first = nd.first;
+	nodes[left].count = half;
+	nodes[left].parent = n;
+	nodes[left + 1].first = nd.first + half;
+	nodes[left + 1].count = nd.count - half;
+	nodes[left + 1].parent = n;
+	nd.left = left;
+
+	if (threads > 1 && nd.count >= ParallelThreshold){
+		std::thread worker(&bvh::build_node, this, left, std::cref(bounds), next_node, threads / 2);
+		build_node(left + 1, bounds, next_node, threads - threads / 2);
+		worker.join();
+	} else {
+		build_node(left, bounds, next_node, 1);
+		build_node(left + 1, bounds, next_node, 1);
+	}
+}
+
+void bvh::refit(const std::vector<aabb>& bounds, const std::vector<uint32_t>& changed){
+	std::vector<uint32_t> dirty;
+	std::vector<bool> marked(nodes.size(), false);
+
+	// Mark the leaves of changed objects and everything above them
+	for (uint32_t obj : changed){
+		uint32_t n = leaf_of[obj];
+		while (!marked[n]){
+			marked[n] = true;
+			dirty.push_back(n);
+			if (n == 0){
+				break;
+			}
+			n = nodes[n].parent;
+		}
+	}
+
+	// Children are always allocated after their parent, so updating in decreasing index order visits children first
+	std::sort(dirty.begin(), dirty.end(), std::greater<uint32_t>());
+	for (uint32_t n : dirty){
+		node& nd = nodes[n];
+		nd.bounds = aabb::empty();
+		if (nd.left == 0){
+			for (uint32_t i = nd.first; i < nd.first + nd.count; i++){
+				nd.bounds.expand(bounds[indices[i]]);
+			}
+		} else {
+			nd.bounds.expand(nodes[nd.left].bounds);
+			nd.bounds.expand(nodes[nd.left + 1].bounds);
+		}
+	}
+}
+
+void bvh::cull(const view_frustum& f, const std::vector<aabb>& bounds, std::vector<uint32_t>& visible) const {
+	if (nodes.empty()){
+		return;
+	}
+
+	uint32_t stack[64];
+	int top = 0;
+	stack[top++] = 0;
+
+	while (top > 0){
+		const node& nd = nodes[stack[--top]];
+		cull_result result = test_bounds(f, nd.bounds);
+
+		if (result == Outside){
+			continue;
+		}
+
+		if (result == Inside){
+			// Whole subtree is visible
+			visible.insert(visible.end(), indices.begin() + nd.first, indices.begin() + nd.first + nd.count);
+		} else if (nd.left == 0){
+			for (uint32_t i = nd.first; i < nd.first + nd.count; i++){
+				if (test_bounds(f, bounds[indices[i]]) != Outside){
+					visible.push_back(indices[i]);
+				}
+			}
+		} else {
+			stack[top++] = nd.left;
+			stack[top++] = nd.left + 1;
+		}
+	}
+}
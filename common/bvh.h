@@ -0,0 +1,74 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include <vector>
+#include <atomic>
+#include <stdint.h>
+
+#include "vmath.h"
+
+// Axis-aligned bounding box
+struct aabb {
+	vmath::vec3 min;
+	vmath::vec3 max;
+
+	static aabb empty();
+	void expand(const vmath::vec3& p);
+	void expand(const aabb& box);
+	vmath::vec3 center() const;
+	vmath::vec3 extents() const;
+};
+
+// Bounds of a set of points
+aabb compute_bounds(const vmath::vec4* points, size_t count);
+
+// Bounds of box after an affine transform
+aabb transform_bounds(const vmath::affine& m, const aabb& box);
+
+// View frustum as six planes (a*x + b*y + c*z + d >= 0 inside), kept as
+// separate component arrays so four planes can be tested at once.
+struct view_frustum {
+	enum { NumPlanes = 8 };		// Six planes padded to a multiple of four
+	float a[NumPlanes], b[NumPlanes], c[NumPlanes], d[NumPlanes];
+
+	// Extracts the planes from a (column-major) view-projection matrix
+	static view_frustum from_matrix(const vmath::mat4& view_proj);
+};
+
+enum cull_result { Outside, Intersecting, Inside };
+
+cull_result test_bounds(const view_frustum& f, const aabb& box);
+
+// Bounding volume hierarchy over a list of boxes (one per scene object)
+class bvh {
+public:
+	// Builds the tree from scratch. Large inputs are split across threads.
+	void build(const std::vector<aabb>& bounds);
+
+	// Updates the boxes of the given objects and the nodes above them.
+	// The object count must not have changed since build().
+	void refit(const std::vector<aabb>& bounds, const std::vector<uint32_t>& changed);
+
+	// Appends the indices of all objects whose box is (at least partly) inside f
+	void cull(const view_frustum& f, const std::vector<aabb>& bounds, std::vector<uint32_t>& visible) const;
+
+	size_t object_count() const { return leaf_of.size(); }
+	size_t node_count() const { return nodes.size(); }
+
+private:
+	struct node {
+		aabb bounds;
+		uint32_t first;		// First entry in indices covered by this node
+		uint32_t count;		// Number of entries covered
+		uint32_t left;		// Index of left child (right is left + 1), 0 for leaves
+		uint32_t parent;
+	};
+
+	std::vector<node> nodes;
+	std::vector<uint32_t> indices;		// Object indices, ordered so every node covers a contiguous range
+	std::vector<uint32_t> leaf_of;		// Leaf node holding each object
+
+	void build_node(uint32_t n, const std::vector<aabb>& bounds, std::atomic<uint32_t>* next_node, unsigned threads);
+};
+
+#endif
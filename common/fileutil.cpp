@@ -0,0 +1,48 @@
+#include <stdio.h>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "fileutil.h"
+
+bool sync_file(FILE* f){
+	if (fflush(f) != 0){
+		return false;
+	}
+#ifdef _WIN32
+	return _commit(_fileno(f)) == 0;
+#else
+	return fsync(fileno(f)) == 0;
+#endif
+}
+
+bool truncate_file(FILE* f, long size){
+	if (fseek(f, 0, SEEK_END) != 0){
+		return false;
+	}
+	long length = ftell(f);
+	if (length < 0){
+		return false;
+	}
+	if (length <= size){
+		return true;
+	}
+#ifdef _WIN32
+	return _chsize(_fileno(f), size) == 0;
+#else
+	return ftruncate(fileno(f), size) == 0;
+#endif
+}
+
+bool replace_file(const std::string& source, const std::string& target){
+#ifdef _WIN32
+	return MoveFileExA(source.c_str(), target.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+	return rename(source.c_str(), target.c_str()) == 0;
+#endif
+}
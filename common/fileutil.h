@@ -0,0 +1,16 @@
+#ifndef FILEUTIL_H
+#define FILEUTIL_H
+
+#include <stdio.h>
+#include <string>
+
+// Flushes f all the way to the disk
+bool sync_file(FILE* f);
+
+// Cuts f back to size bytes if it is longer
+bool truncate_file(FILE* f, long size);
+
+// Replaces target with source in one step, so readers see either the old or the new file
+bool replace_file(const std::string& source, const std::string& target);
+
+#endif
@@ -0,0 +1,101 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  --- glstate.cpp ---
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include <cstring>
+
+#include "glstate.h"
+
+//----------------------------------------------------------------------------
+
+namespace {
+
+const GLuint Unknown = ~0u;
+
+GLuint currentProgram = Unknown;
+GLuint currentVertexArray = Unknown;
+GLuint currentArrayBuffer = Unknown;
+GLuint currentElementBuffer = Unknown;
+GLuint currentUniformBuffer = Unknown;
+
+GLStateCounters counters;
+
+GLuint* bufferSlot( GLenum target )
+{
+    switch ( target ) {
+        case GL_ARRAY_BUFFER:         return &currentArrayBuffer;
+        case GL_ELEMENT_ARRAY_BUFFER: return &currentElementBuffer;
+        case GL_UNIFORM_BUFFER:       return &currentUniformBuffer;
+        default:                      return NULL;
+    }
+}
+
+}
+
+//----------------------------------------------------------------------------
+
+void glsUseProgram( GLuint program )
+{
+    if ( program == currentProgram ) {
+        counters.program.skipped++;
+        return;
+    }
+
+    glUseProgram( program );
+    currentProgram = program;
+    counters.program.issued++;
+}
+
+void glsBindVertexArray( GLuint vao )
+{
+    if ( vao == currentVertexArray ) {
+        counters.vertexArray.skipped++;
+        return;
+    }
+
+    glBindVertexArray( vao );
+    currentVertexArray = vao;
+    currentElementBuffer = Unknown;
+    counters.vertexArray.issued++;
+}
+
+void glsBindBuffer( GLenum target, GLuint buffer )
+{
+    GLuint* slot = bufferSlot( target );
+
+    if ( slot != NULL && *slot == buffer ) {
+        counters.buffer.skipped++;
+        return;
+    }
+
+    glBindBuffer( target, buffer );
+    if ( slot != NULL ) {
+        *slot = buffer;
+    }
+    counters.buffer.issued++;
+}
+
+void glsInvalidate()
+{
+    currentProgram = Unknown;
+    currentVertexArray = Unknown;
+    currentArrayBuffer = Unknown;
+    currentElementBuffer = Unknown;
+    currentUniformBuffer = Unknown;
+}
+
+//----------------------------------------------------------------------------
+
+const GLStateCounters& glsCounters()
+{
+    return counters;
+}
+
+void glsResetCounters()
+{
+    memset( &counters, 0, sizeof(counters) );
+}
+
+//----------------------------------------------------------------------------
@@ -0,0 +1,51 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  --- glstate.h ---
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef __GLSTATE_H__
+#define __GLSTATE_H__
+
+#include "../include/GLEW/glew.h"
+
+//----------------------------------------------------------------------------
+//
+//  Thin wrappers over GL calls that remember the last value set and skip the
+//    call when it would not change anything. All binds of the wrapped state
+//    must go through these functions (or be followed by glsInvalidate()) for
+//    the cache to stay correct.
+//
+//  GL_ELEMENT_ARRAY_BUFFER is part of the vertex array state, so it is only
+//    cached per bound vertex array and forgotten whenever the VAO changes.
+//
+
+void glsUseProgram( GLuint program );
+void glsBindVertexArray( GLuint vao );
+void glsBindBuffer( GLenum target, GLuint buffer );
+
+// Forgets all cached state (e.g. after calling GL directly)
+void glsInvalidate();
+
+//----------------------------------------------------------------------------
+//
+//  Counters of calls issued to GL and calls skipped as redundant.
+//
+
+typedef struct {
+    unsigned long issued;
+    unsigned long skipped;
+} GLStateCounter;
+
+typedef struct {
+    GLStateCounter program;
+    GLStateCounter vertexArray;
+    GLStateCounter buffer;
+} GLStateCounters;
+
+const GLStateCounters& glsCounters();
+void glsResetCounters();
+
+//----------------------------------------------------------------------------
+
+#endif // __GLSTATE_H__
@@ -0,0 +1,143 @@
+#include <sstream>
+#include <chrono>
+
+#include "journal.h"
+#include "fileutil.h"
+
+const int journal::CommitInterval;
+
+journal::journal() : file(nullptr), stopping(false), submitted(0), completed(0), commits(0), records(0) {}
+
+journal::~journal(){
+	close();
+}
+
+bool journal::open(const std::string& journal_file, const std::string& snapshot_file, long valid_size){
+	close();
+	journal_path = journal_file;
+	snapshot_path = snapshot_file;
+
+	file = fopen(journal_path.c_str(), "ab");
+	if (!file){
+		return false;
+	}
+	if (!truncate_file(file, valid_size)){
+		fclose(file);
+		file = nullptr;
+		return false;
+	}
+
+	stopping.store(false);
+	thread = std::thread(&journal::run, this);
+	return true;
+}
+
+void journal::close(){
+	if (thread.joinable()){
+		stopping.store(true);
+		wake.notify_one();
+		thread.join();
+	}
+	if (file){
+		fclose(file);
+		file = nullptr;
+	}
+}
+
+void journal::append(std::string record){
+	job j;
+	j.record.swap(record);
+	submitted++;
+	queue.push(std::move(j));
+	wake.notify_one();
+}
+
+void journal::write_snapshot(std::function<void(std::ostream&)> write){
+	job j;
+	j.snapshot.swap(write);
+	submitted++;
+	queue.push(std::move(j));
+	wake.notify_one();
+}
+
+void journal::flush(){
+	if (!thread.joinable()){
+		return;
+	}
+	size_t target = submitted.load();
+	wake.notify_one();
+
+	std::unique_lock<std::mutex> lock(wake_mutex);
+	idle.wait(lock, [this, target]{ return completed >= target; });
+}
+
+// I/O thread
+void journal::run(){
+	bool last_pass = false;
+	while (!last_pass){
+		{
+			std::unique_lock<std::mutex> lock(wake_mutex);
+			wake.wait_for(lock, std::chrono::milliseconds(CommitInterval), [this]{ return stopping.load() || !queue.empty(); });
+		}
+		// Anything queued before stopping was set is picked up by this pass
+		last_pass = stopping.load();
+
+		pending.clear();
+		queue.drain(pending);
+		for (size_t i = 0; i < pending.size(); i++){
+			if (pending[i].snapshot){
+				// Earlier records are part of the snapshot, the journal restarts after it
+				if (replace_snapshot(pending[i].snapshot)){
+					buffer.clear();
+					file = freopen(journal_path.c_str(), "wb", file);
+					if (!file){
+						// Keep appending instead; replay skips the records the snapshot already holds
+						printf("Could not empty the journal %s, appending to it\n", journal_path.c_str());
+						file = fopen(journal_path.c_str(), "ab");
+					}
+				}
+			} else {
+				buffer += pending[i].record;
+				records++;
+			}
+		}
+
+		if (!buffer.empty() && !file){
+			file = fopen(journal_path.c_str(), "ab");
+			if (!file){
+				printf("Could not open the journal %s, %u bytes of changes were not saved\n", journal_path.c_str(), (unsigned)buffer.size());
+				buffer.clear();
+			}
+		}
+		if (!buffer.empty()){
+			fwrite(buffer.data(), 1, buffer.size(), file);
+			sync_file(file);
+			buffer.clear();
+			commits++;
+		}
+
+		if (!pending.empty()){
+			std::lock_guard<std::mutex> lock(wake_mutex);
+			completed += pending.size();
+		}
+		idle.notify_all();
+	}
+}
+
+bool journal::replace_snapshot(std::function<void(std::ostream&)>& write){
+	std::ostringstream contents;
+	write(contents);
+	std::string data = contents.str();
+
+	std::string temp_path = snapshot_path + ".tmp";
+	FILE* temp = fopen(temp_path.c_str(), "wb");
+	if (!temp){
+		return false;
+	}
+	bool written = fwrite(data.data(), 1, data.size(), temp) == data.size();
+	written = sync_file(temp) && written;
+	fclose(temp);
+
+	// The snapshot must be complete on disk before it replaces the old one
+	return written && replace_file(temp_path, snapshot_path);
+}
@@ -0,0 +1,84 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stdio.h>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "mpscqueue.h"
+
+// Append-only journal backed by a snapshot file, written on a background I/O thread.
+// append() and write_snapshot() only queue work and return immediately. The I/O thread
+// wakes up at most every CommitInterval milliseconds (or when work arrives) and writes
+// everything queued since its last pass with a single write and flush (group commit).
+// A snapshot is written to a temporary file that then atomically replaces the snapshot
+// file, after which the journal is truncated, so a crash at any point leaves either the
+// old or the new snapshot in place with its journal still alongside.
+class journal {
+public:
+	journal();
+	~journal();
+
+	// Opens journal_path for appending and starts the I/O thread. The journal is first cut
+	// back to valid_size (the end of its last complete record), so a torn write left by a
+	// crash is not followed by the records appended from now on.
+	bool open(const std::string& journal_path, const std::string& snapshot_path, long valid_size);
+
+	// Writes everything still queued and stops the I/O thread
+	void close();
+
+	// Queues text to append to the journal. Safe to call from any thread.
+	void append(std::string record);
+
+	// Queues a new snapshot; write is called on the I/O thread to produce its contents.
+	// Records appended before this call are expected to be part of it.
+	void write_snapshot(std::function<void(std::ostream&)> write);
+
+	// Blocks until everything queued so far is on disk, with any queued snapshot in place
+	// and the journal emptied after it, so the files can be read back.
+	void flush();
+
+	// Number of group commits and records written so far
+	size_t commit_count() const { return commits.load(); }
+	size_t record_count() const { return records.load(); }
+
+	static const int CommitInterval = 10;
+
+private:
+	struct job {
+		std::string record;
+		std::function<void(std::ostream&)> snapshot;	// Set for snapshot jobs
+	};
+
+	journal(const journal&);
+	journal& operator=(const journal&);
+
+	void run();
+	bool replace_snapshot(std::function<void(std::ostream&)>& write);
+
+	std::string journal_path;
+	std::string snapshot_path;
+	FILE* file;
+
+	mpsc_queue<job> queue;
+	std::vector<job> pending;		// Jobs taken from the queue by the I/O thread
+	std::string buffer;				// Records of one group commit
+
+	std::thread thread;
+	std::mutex wake_mutex;
+	std::condition_variable wake;
+	std::condition_variable idle;	// Signalled after each pass of the I/O thread
+	std::atomic<bool> stopping;
+	std::atomic<size_t> submitted;	// Jobs queued so far
+	size_t completed;				// Jobs written so far, guarded by wake_mutex
+	std::atomic<size_t> commits;
+	std::atomic<size_t> records;
+};
+
+#endif
@@ -0,0 +1,109 @@
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "mappedfile.h"
+
+#ifdef _WIN32
+
+mapped_file::mapped_file() : view(nullptr), length(0), file(INVALID_HANDLE_VALUE), mapping(nullptr) {}
+
+bool mapped_file::open(const char* path){
+	close();
+
+	file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE){
+		return false;
+	}
+
+	LARGE_INTEGER file_size;
+	if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0){
+		close();
+		return false;
+	}
+
+	mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (!mapping){
+		close();
+		return false;
+	}
+
+	view = (const unsigned char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if (!view){
+		close();
+		return false;
+	}
+	length = (size_t)file_size.QuadPart;
+	return true;
+}
+
+void mapped_file::close(){
+	if (view){
+		UnmapViewOfFile(view);
+	}
+	if (mapping){
+		CloseHandle(mapping);
+	}
+	if (file != INVALID_HANDLE_VALUE){
+		CloseHandle(file);
+	}
+	view = nullptr;
+	length = 0;
+	mapping = nullptr;
+	file = INVALID_HANDLE_VALUE;
+}
+
+#else
+
+mapped_file::mapped_file() : view(nullptr), length(0), file(-1) {}
+
+bool mapped_file::open(const char* path){
+	close();
+
+	file = ::open(path, O_RDONLY);
+	if (file < 0){
+		return false;
+	}
+
+	struct stat info;
+	if (fstat(file, &info) != 0 || info.st_size == 0){
+		close();
+		return false;
+	}
+
+	void* address = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+	if (address == MAP_FAILED){
+		close();
+		return false;
+	}
+	view = (const unsigned char*)address;
+	length = (size_t)info.st_size;
+
+	// The whole file is read front to back
+	madvise(address, length, MADV_SEQUENTIAL);
+	return true;
+}
+
+void mapped_file::close(){
+	if (view){
+		munmap((void*)view, length);
+	}
+	if (file >= 0){
+		::close(file);
+	}
+	view = nullptr;
+	length = 0;
+	file = -1;
+}
+
+#endif
+
+mapped_file::~mapped_file(){
+	close();
+}
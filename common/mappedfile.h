@@ -0,0 +1,32 @@
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include <stddef.h>
+
+// Read-only memory mapping of a whole file
+class mapped_file {
+public:
+	mapped_file();
+	~mapped_file();
+
+	bool open(const char* path);
+	void close();
+
+	const unsigned char* data() const { return view; }
+	size_t size() const { return length; }
+
+private:
+	mapped_file(const mapped_file&);
+	mapped_file& operator=(const mapped_file&);
+
+	const unsigned char* view;
+	size_t length;
+#ifdef _WIN32
+	void* file;
+	void* mapping;
+#else
+	int file;
+#endif
+};
+
+#endif
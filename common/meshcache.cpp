@@ -0,0 +1,267 @@
+#include <stdio.h>
+#include <string.h>
+#include <float.h>
+#include <math.h>
+#include <sys/stat.h>
+
+#include "meshcache.h"
+#include "objloader.h"
+#include "meshopt.h"
+#include "fileutil.h"
+
+// Share of the vertex cache miss ratio that overdraw ordering may give up
+static const float OverdrawThreshold = 1.05f;
+
+static inline uint32_t align16(uint32_t offset){
+	return (offset + 15) & ~15u;
+}
+
+bool get_mesh_source_key(const char * path, mesh_source_key & key){
+	struct stat info;
+	if( stat(path, &info) != 0 ){
+		return false;
+	}
+	key.size = (uint64_t)info.st_size;
+	key.mtime = (int64_t)info.st_mtime;
+	return true;
+}
+
+std::string mesh_cache_path(const char * obj_path){
+	return std::string(obj_path) + ".mesh";
+}
+
+bool compile_mesh(const char * obj_path, const mesh_source_key & key, std::vector<char> & blob){
+	std::vector<vmath::vec4> vertices;
+	std::vector<vmath::vec2> uvs;
+	std::vector<vmath::vec3> normals;
+	if( !loadOBJ(obj_path, vertices, uvs, normals) ){
+		return false;
+	}
+
+	// Weld corners with the same position, texture coordinate and normal. The OBJ loader emits one vertex per
+	// triangle corner, so the welded index of each corner is its index buffer entry.
+	const size_t CornerFloats = 4 + 2 + 3;
+	std::vector<float> corners(vertices.size() * CornerFloats);
+	for( size_t i = 0; i < vertices.size(); i++ ){
+		float * corner = &corners[i * CornerFloats];
+		memcpy(corner, &vertices[i], 4 * sizeof(float));
+		memcpy(corner + 4, &uvs[i], 2 * sizeof(float));
+		memcpy(corner + 6, &normals[i], 3 * sizeof(float));
+	}
+	std::vector<uint32_t> remap;
+	size_t corner_count = vertices.size();
+	size_t unique = weld_vertices(corners.data(), corner_count, CornerFloats, remap);
+	std::vector<uint32_t> indices(remap);
+	remap_vertices(vertices, remap, unique);
+	remap_vertices(uvs, remap, unique);
+	remap_vertices(normals, remap, unique);
+
+	build_mesh_file(vertices, uvs, normals, indices, key, (uint32_t)corner_count, blob);
+	return true;
+}
+
+void build_mesh_file(std::vector<vmath::vec4> & vertices, std::vector<vmath::vec2> & uvs, std::vector<vmath::vec3> & normals,
+	std::vector<uint32_t> & indices, const mesh_source_key & key, uint32_t source_vertex_count, std::vector<char> & blob){
+	mesh_file_header header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, MeshFileMagic, sizeof(header.magic));
+	header.version = MeshFileVersion;
+	header.source_size = key.size;
+	header.source_mtime = key.mtime;
+	header.stats.source_vertex_count = source_vertex_count;
+
+	size_t unique = vertices.size();
+	std::vector<uint32_t> remap;
+	header.stats.welded_acmr = compute_acmr(indices.data(), indices.size(), unique, AcmrCacheSize);
+
+	// Triangle order for the vertex cache then overdraw
+	optimize_vertex_cache(indices.data(), indices.size(), unique);
+	if( unique ){
+		optimize_overdraw(indices.data(), indices.size(), &vertices[0][0], 4, unique, OverdrawThreshold);
+	}
+	header.stats.optimized_acmr = compute_acmr(indices.data(), indices.size(), unique, AcmrCacheSize);
+
+	// Bounds, and the radius level of detail errors are measured against
+	for( int c = 0; c < 3; c++ ){
+		header.bounds_min[c] = vertices.empty() ? 0.0f : FLT_MAX;
+		header.bounds_max[c] = vertices.empty() ? 0.0f : -FLT_MAX;
+	}
+	for( size_t i = 0; i < vertices.size(); i++ ){
+		for( int c = 0; c < 3; c++ ){
+			if( vertices[i][c] < header.bounds_min[c] ) header.bounds_min[c] = vertices[i][c];
+			if( vertices[i][c] > header.bounds_max[c] ) header.bounds_max[c] = vertices[i][c];
+		}
+	}
+
+	float diagonal = 0.0f;
+	for( int c = 0; c < 3; c++ ){
+		diagonal += (header.bounds_max[c] - header.bounds_min[c]) * (header.bounds_max[c] - header.bounds_min[c]);
+	}
+	float radius = 0.5f * sqrtf(diagonal);
+
+	// Levels of detail, each simplified from the level before to half its triangles, so a level's error is at most
+	// the sum of the errors of the steps to it. The chain ends when simplification stalls (seams and borders are
+	// kept) or the mesh gets small.
+	header.lod_count = 1;
+	header.lods[0].index_count = (uint32_t)indices.size();
+	std::vector<uint32_t> previous(indices);
+	std::vector<uint32_t> level(indices.size());
+	while( header.lod_count < MeshMaxLods && unique ){
+		size_t target = previous.size() / 6 * 3;
+		if( target < MinLodTriangles * 3 ){
+			break;
+		}
+		float error;
+		size_t count = simplify_mesh(level.data(), previous.data(), previous.size(), &vertices[0][0], 4, unique, target, error);
+		if( count > previous.size() * 3 / 4 ){
+			break;
+		}
+		optimize_vertex_cache(level.data(), count, unique);
+
+		mesh_file_lod & lod = header.lods[header.lod_count++];
+		lod.index_offset = (uint32_t)indices.size();
+		lod.index_count = (uint32_t)count;
+		lod.error = header.lods[header.lod_count - 2].error + (radius > 0.0f ? error / radius : 0.0f);
+		indices.insert(indices.end(), level.begin(), level.begin() + count);
+		previous.assign(level.begin(), level.begin() + count);
+	}
+
+	// Vertex order for fetching, by first use in the full mesh (coarser levels only use a subset of its vertices)
+	unique = optimize_vertex_fetch(indices.data(), indices.size(), unique, remap);
+	remap_vertices(vertices, remap, unique);
+	remap_vertices(uvs, remap, unique);
+	remap_vertices(normals, remap, unique);
+
+	header.vertex_count = (uint32_t)unique;
+
+	// Streams in attribute order, each starting on a 16 byte boundary
+	const void * streams[MeshNumAttributes] = {vertices.data(), normals.data(), uvs.data()};
+	const uint32_t components[MeshNumAttributes] = {4, 3, 2};
+	uint32_t offset = align16(sizeof(mesh_file_header));
+	for( int a = 0; a < MeshNumAttributes; a++ ){
+		header.attributes[a].components = components[a];
+		header.attributes[a].offset = offset;
+		header.attributes[a].size = header.vertex_count * components[a] * sizeof(float);
+		offset = align16(offset + header.attributes[a].size);
+	}
+	header.index_count = (uint32_t)indices.size();
+	header.index_offset = offset;
+	offset += header.index_count * sizeof(uint32_t);
+
+	blob.assign(offset, 0);
+	memcpy(&blob[0], &header, sizeof(header));
+	for( int a = 0; a < MeshNumAttributes; a++ ){
+		if( header.attributes[a].size ){
+			memcpy(&blob[header.attributes[a].offset], streams[a], header.attributes[a].size);
+		}
+	}
+	if( header.index_count ){
+		memcpy(&blob[header.index_offset], indices.data(), header.index_count * sizeof(uint32_t));
+	}
+}
+
+bool write_mesh_file(const char * path, const std::vector<char> & blob){
+	std::string temp_path = std::string(path) + ".tmp";
+	FILE * file = fopen(temp_path.c_str(), "wb");
+	if( !file ){
+		return false;
+	}
+	bool written = fwrite(blob.data(), 1, blob.size(), file) == blob.size();
+	written = fclose(file) == 0 && written;
+
+	if( !written || !replace_file(temp_path, path) ){
+		remove(temp_path.c_str());
+		return false;
+	}
+	return true;
+}
+
+const mesh_file_header * check_mesh_file(const void * data, size_t size){
+	if( !data || size < sizeof(mesh_file_header) ){
+		return NULL;
+	}
+
+	const mesh_file_header * header = (const mesh_file_header *)data;
+	if( memcmp(header->magic, MeshFileMagic, sizeof(MeshFileMagic)) != 0 || header->version != MeshFileVersion ){
+		return NULL;
+	}
+
+	for( int a = 0; a < MeshNumAttributes; a++ ){
+		const mesh_file_attribute & attribute = header->attributes[a];
+		if( (uint64_t)attribute.offset + attribute.size > size || attribute.offset % 16 != 0 ||
+			(uint64_t)header->vertex_count * attribute.components * sizeof(float) != attribute.size ){
+			return NULL;
+		}
+	}
+	if( (uint64_t)header->index_offset + (uint64_t)header->index_count * sizeof(uint32_t) > size || header->index_offset % 4 != 0 ||
+		header->index_count % 3 != 0 ){
+		return NULL;
+	}
+
+	// Every level must be a triangle list inside the index section
+	if( header->lod_count < 1 || header->lod_count > MeshMaxLods ){
+		return NULL;
+	}
+	for( uint32_t l = 0; l < header->lod_count; l++ ){
+		const mesh_file_lod & lod = header->lods[l];
+		if( (uint64_t)lod.index_offset + lod.index_count > header->index_count || lod.index_count % 3 != 0 ){
+			return NULL;
+		}
+	}
+
+	// Indices may only refer to vertices in the file
+	const uint32_t * indices = (const uint32_t *)((const char *)data + header->index_offset);
+	for( uint32_t i = 0; i < header->index_count; i++ ){
+		if( indices[i] >= header->vertex_count ){
+			return NULL;
+		}
+	}
+	return header;
+}
+
+bool mesh_cache::open(const char * cache_path, const mesh_source_key * key){
+	header = NULL;
+	memory.clear();
+	if( !file.open(cache_path) ){
+		return false;
+	}
+
+	header = check_mesh_file(file.data(), file.size());
+	if( header && key && (header->source_size != key->size || header->source_mtime != key->mtime) ){
+		header = NULL;
+	}
+	if( !header ){
+		file.close();
+		return false;
+	}
+	return true;
+}
+
+bool mesh_cache::assign(std::vector<char> & blob){
+	file.close();
+	memory.swap(blob);
+	header = check_mesh_file(memory.data(), memory.size());
+	return header != NULL;
+}
+
+bool mesh_cache::load(const char * obj_path){
+	mesh_source_key key;
+	if( !get_mesh_source_key(obj_path, key) ){
+		printf("Impossible to open the file %s ! Are you in the right path ?\n", obj_path);
+		return false;
+	}
+
+	std::string cache_path = mesh_cache_path(obj_path);
+	if( open(cache_path.c_str(), &key) ){
+		return true;
+	}
+
+	std::vector<char> blob;
+	if( !compile_mesh(obj_path, key, blob) ){
+		return false;
+	}
+	if( !write_mesh_file(cache_path.c_str(), blob) ){
+		printf("Could not write mesh cache %s, using the parsed mesh\n", cache_path.c_str());
+	}
+	return assign(blob);
+}
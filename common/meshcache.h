@@ -0,0 +1,130 @@
+#ifndef MESHCACHE_H
+#define MESHCACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "mappedfile.h"
+#include "vmath.h"
+
+// Compiled mesh file, written next to the OBJ it was made from ("<obj path>.mesh") and laid out
+// so its vertex streams can be handed to glBufferData straight from a memory mapping:
+//
+//   mesh_file_header
+//   one stream per attribute              at attributes[semantic].offset (16-byte aligned)
+//   uint32_t indices[index_count]         at index_offset (one triangle list per level of detail)
+//
+// Identical OBJ vertices are welded, and triangles and vertices are ordered for the vertex cache,
+// overdraw and vertex fetch (see meshopt.h). Level 0 is the full mesh; each further level is a
+// simplification with about half the triangles of the one before, drawing from the same vertices. The header keeps the size and modification time of the
+// source OBJ; a cache whose source has changed since is compiled again.
+
+static const char MeshFileMagic[4] = {'O', 'C', 'M', 'S'};
+static const uint32_t MeshFileVersion = 3;
+
+// Most levels of detail in a mesh file, and the fewest triangles worth building another level for
+static const uint32_t MeshMaxLods = 6;
+static const uint32_t MinLodTriangles = 32;
+
+enum mesh_attribute {MeshPosition, MeshNormal, MeshTexCoord, MeshNumAttributes};
+
+struct mesh_file_attribute {
+	uint32_t components;		// Floats per vertex, 0 if the mesh has no such attribute
+	uint32_t offset;
+	uint32_t size;				// Bytes
+	uint32_t reserved;
+};
+
+// How much indexing saved, measured when the mesh was compiled
+struct mesh_file_stats {
+	uint32_t source_vertex_count;	// Vertices before welding (one per triangle corner)
+	float welded_acmr;				// ACMR of the welded mesh in source triangle order
+	float optimized_acmr;
+	uint32_t reserved;
+};
+
+struct mesh_file_lod {
+	uint32_t index_offset;		// First index of the level in the index section
+	uint32_t index_count;
+	float error;				// Geometric error of the level relative to the mesh radius (half the bounds diagonal)
+	uint32_t reserved;
+};
+
+struct mesh_file_header {
+	char magic[4];
+	uint32_t version;
+	uint64_t source_size;
+	int64_t source_mtime;
+	uint32_t vertex_count;
+	uint32_t index_count;		// Indices of all levels
+	uint32_t index_offset;
+	uint32_t lod_count;
+	float bounds_min[3];
+	float bounds_max[3];
+	mesh_file_stats stats;
+	mesh_file_attribute attributes[MeshNumAttributes];
+	mesh_file_lod lods[MeshMaxLods];
+};
+
+// Identifies the version of a source file
+struct mesh_source_key {
+	uint64_t size;
+	int64_t mtime;
+};
+
+bool get_mesh_source_key(const char * path, mesh_source_key & key);
+
+std::string mesh_cache_path(const char * obj_path);
+
+// Parses an OBJ file into an optimized, indexed mesh file image in blob
+bool compile_mesh(const char * obj_path, const mesh_source_key & key, std::vector<char> & blob);
+
+// Optimizes an indexed triangle list (reordering the arrays passed in) and writes it as a mesh file image
+// into blob. source_vertex_count is the vertex count of the mesh it was made from, for the statistics.
+void build_mesh_file(std::vector<vmath::vec4> & vertices, std::vector<vmath::vec2> & uvs, std::vector<vmath::vec3> & normals,
+	std::vector<uint32_t> & indices, const mesh_source_key & key, uint32_t source_vertex_count, std::vector<char> & blob);
+
+// Writes blob to path through a temporary file, so a reader never sees half a cache
+bool write_mesh_file(const char * path, const std::vector<char> & blob);
+
+// Returns the header if data holds a mesh file of a supported version whose streams all lie inside it
+const mesh_file_header * check_mesh_file(const void * data, size_t size);
+
+// A loaded mesh, either mapped from its cache file or compiled into memory
+class mesh_cache {
+public:
+	mesh_cache() : header(NULL) {}
+
+	// Maps the cache file, failing if it is missing, invalid or (with a key) out of date
+	bool open(const char * cache_path, const mesh_source_key * key);
+
+	// Uses a compiled image instead of a file
+	bool assign(std::vector<char> & blob);
+
+	// Opens the cache of an OBJ file, compiling it first if there is none or it is out of date
+	bool load(const char * obj_path);
+
+	uint32_t vertex_count() const { return header->vertex_count; }
+	uint32_t index_count() const { return header->index_count; }
+	const float * bounds_min() const { return header->bounds_min; }
+	const float * bounds_max() const { return header->bounds_max; }
+
+	uint32_t components(mesh_attribute a) const { return header->attributes[a].components; }
+	uint32_t size(mesh_attribute a) const { return header->attributes[a].size; }
+	const void * data(mesh_attribute a) const { return (const char *)header + header->attributes[a].offset; }
+	const uint32_t * indices() const { return (const uint32_t *)((const char *)header + header->index_offset); }
+	const mesh_file_stats & stats() const { return header->stats; }
+	uint32_t lod_count() const { return header->lod_count; }
+	const mesh_file_lod & lod(uint32_t level) const { return header->lods[level]; }
+
+	bool from_file() const { return !memory.size(); }
+
+private:
+	mapped_file file;
+	std::vector<char> memory;
+	const mesh_file_header * header;
+};
+
+#endif
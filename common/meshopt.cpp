@@ -0,0 +1,591 @@
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+
+#include "meshopt.h"
+
+// Smallest run of triangles optimize_overdraw moves as a unit
+static const size_t MinClusterTriangles = 16;
+
+static const uint32_t NoVertex = ~0u;
+
+static inline uint32_t hash_float(float f){
+	// 0 and -0 compare equal, so they must hash alike
+	uint32_t bits;
+	if( f == 0.0f ){
+		return 0;
+	}
+	memcpy(&bits, &f, sizeof(bits));
+	return bits;
+}
+
+size_t weld_vertices(const float * vertices, size_t count, size_t stride, std::vector<uint32_t> & remap){
+	remap.assign(count, NoVertex);
+
+	// Open addressing table of the first vertex seen with each value, at most half full
+	size_t table_size = 1;
+	while( table_size < count * 2 ){
+		table_size *= 2;
+	}
+	std::vector<uint32_t> table(table_size, NoVertex);
+	std::vector<uint32_t> table_id(table_size);
+
+	size_t unique = 0;
+	for( size_t i = 0; i < count; i++ ){
+		const float * vertex = vertices + i * stride;
+		uint32_t hash = 2166136261u;
+		for( size_t c = 0; c < stride; c++ ){
+			hash = (hash ^ hash_float(vertex[c])) * 16777619u;
+		}
+
+		size_t slot = hash & (table_size - 1);
+		for( size_t probe = 1; ; probe++ ){
+			uint32_t other = table[slot];
+			if( other == NoVertex ){
+				table[slot] = (uint32_t)i;
+				table_id[slot] = (uint32_t)unique;
+				remap[i] = (uint32_t)unique++;
+				break;
+			}
+
+			const float * other_vertex = vertices + other * stride;
+			size_t c = 0;
+			while( c < stride && vertex[c] == other_vertex[c] ){
+				c++;
+			}
+			if( c == stride ){
+				remap[i] = table_id[slot];
+				break;
+			}
+			slot = (slot + probe) & (table_size - 1);
+		}
+	}
+	return unique;
+}
+
+// Forsyth's vertex score: recently used vertices score high (except the last triangle's, which would just
+// repeat it), and vertices with few triangles left score higher so they get finished off and leave the cache
+static float vertex_score(int cache_position, uint32_t live_triangles){
+	if( live_triangles == 0 ){
+		return -1.0f;
+	}
+
+	float score = 0.0f;
+	if( cache_position >= 0 ){
+		if( cache_position < 3 ){
+			score = 0.75f;
+		} else {
+			score = powf(1.0f - (cache_position - 3) * (1.0f / (VertexCacheSize - 3)), 1.5f);
+		}
+	}
+	return score + 2.0f / sqrtf((float)live_triangles);
+}
+
+void optimize_vertex_cache(uint32_t * indices, size_t index_count, size_t vertex_count){
+	size_t triangle_count = index_count / 3;
+	if( triangle_count == 0 ){
+		return;
+	}
+
+	// Triangles using each vertex. The first live[v] entries of a vertex's list are the ones not yet emitted.
+	std::vector<uint32_t> offsets(vertex_count + 1, 0);
+	std::vector<uint32_t> live(vertex_count, 0);
+	for( size_t i = 0; i < triangle_count * 3; i++ ){
+		live[indices[i]]++;
+	}
+	for( size_t v = 0; v < vertex_count; v++ ){
+		offsets[v + 1] = offsets[v] + live[v];
+	}
+	std::vector<uint32_t> adjacency(triangle_count * 3);
+	std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+	for( size_t i = 0; i < triangle_count * 3; i++ ){
+		adjacency[fill[indices[i]]++] = (uint32_t)(i / 3);
+	}
+
+	std::vector<int> cache_position(vertex_count, -1);
+	std::vector<float> vscore(vertex_count);
+	for( size_t v = 0; v < vertex_count; v++ ){
+		vscore[v] = vertex_score(-1, live[v]);
+	}
+
+	std::vector<float> tscore(triangle_count);
+	std::vector<char> emitted(triangle_count, 0);
+	size_t best = 0;
+	for( size_t t = 0; t < triangle_count; t++ ){
+		tscore[t] = vscore[indices[t * 3]] + vscore[indices[t * 3 + 1]] + vscore[indices[t * 3 + 2]];
+		if( tscore[t] > tscore[best] ){
+			best = t;
+		}
+	}
+
+	std::vector<uint32_t> result(triangle_count * 3);
+	std::vector<uint32_t> cache, new_cache;
+	cache.reserve(VertexCacheSize + 3);
+	new_cache.reserve(VertexCacheSize + 3);
+	size_t input_cursor = 0;
+
+	for( size_t out = 0; out < triangle_count; out++ ){
+		// Nothing in the cache has triangles left, continue with the next triangle in input order
+		if( best == NoVertex ){
+			while( emitted[input_cursor] ){
+				input_cursor++;
+			}
+			best = input_cursor;
+		}
+
+		const uint32_t * triangle = &indices[best * 3];
+		memcpy(&result[out * 3], triangle, 3 * sizeof(uint32_t));
+		emitted[best] = 1;
+
+		// The triangle's vertices move to the front of the cache
+		new_cache.clear();
+		for( int k = 0; k < 3; k++ ){
+			if( std::find(new_cache.begin(), new_cache.end(), triangle[k]) == new_cache.end() ){
+				new_cache.push_back(triangle[k]);
+			}
+		}
+		for( size_t i = 0; i < cache.size(); i++ ){
+			if( cache[i] != triangle[0] && cache[i] != triangle[1] && cache[i] != triangle[2] ){
+				new_cache.push_back(cache[i]);
+			}
+		}
+
+		for( int k = 0; k < 3; k++ ){
+			uint32_t v = triangle[k];
+			uint32_t * list = &adjacency[offsets[v]];
+			for( uint32_t j = 0; j < live[v]; j++ ){
+				if( list[j] == best ){
+					list[j] = list[live[v] - 1];
+					live[v]--;
+					break;
+				}
+			}
+		}
+
+		// Rescore the cached vertices (including the ones just pushed out) and their remaining triangles
+		for( size_t i = 0; i < new_cache.size(); i++ ){
+			uint32_t v = new_cache[i];
+			cache_position[v] = i < VertexCacheSize ? (int)i : -1;
+			vscore[v] = vertex_score(cache_position[v], live[v]);
+		}
+
+		best = NoVertex;
+		float best_score = -1.0f;
+		for( size_t i = 0; i < new_cache.size(); i++ ){
+			uint32_t v = new_cache[i];
+			const uint32_t * list = &adjacency[offsets[v]];
+			for( uint32_t j = 0; j < live[v]; j++ ){
+				uint32_t t = list[j];
+				tscore[t] = vscore[indices[t * 3]] + vscore[indices[t * 3 + 1]] + vscore[indices[t * 3 + 2]];
+				if( tscore[t] > best_score ){
+					best_score = tscore[t];
+					best = t;
+				}
+			}
+		}
+
+		if( new_cache.size() > VertexCacheSize ){
+			new_cache.resize(VertexCacheSize);
+		}
+		cache.swap(new_cache);
+	}
+
+	memcpy(indices, result.data(), result.size() * sizeof(uint32_t));
+}
+
+// Runs a triangle through a FIFO cache, returning how many of its vertices had to be transformed. A vertex is
+// cached while fewer than cache_size misses happened since its own; advancing time past cache_size flushes the cache.
+static uint32_t simulate_fifo(const uint32_t * triangle, std::vector<uint32_t> & timestamps, uint32_t & time, size_t cache_size){
+	uint32_t misses = 0;
+	for( int k = 0; k < 3; k++ ){
+		uint32_t v = triangle[k];
+		if( time - timestamps[v] > cache_size ){
+			timestamps[v] = time++;
+			misses++;
+		}
+	}
+	return misses;
+}
+
+float compute_acmr(const uint32_t * indices, size_t index_count, size_t vertex_count, size_t cache_size){
+	size_t triangle_count = index_count / 3;
+	if( triangle_count == 0 ){
+		return 0.0f;
+	}
+
+	std::vector<uint32_t> timestamps(vertex_count, 0);
+	uint32_t time = (uint32_t)cache_size + 1;
+	size_t misses = 0;
+	for( size_t t = 0; t < triangle_count; t++ ){
+		misses += simulate_fifo(&indices[t * 3], timestamps, time, cache_size);
+	}
+	return (float)misses / triangle_count;
+}
+
+struct triangle_cluster {
+	size_t start;
+	size_t end;
+	float sort_key;
+};
+
+void optimize_overdraw(uint32_t * indices, size_t index_count, const float * positions, size_t stride, size_t vertex_count, float threshold){
+	size_t triangle_count = index_count / 3;
+	if( triangle_count < 2 ){
+		return;
+	}
+	float input_acmr = compute_acmr(indices, triangle_count * 3, vertex_count, AcmrCacheSize);
+
+	// Hard boundaries: triangles that miss the cache on all three vertices, where the optimizer started over
+	std::vector<uint32_t> timestamps(vertex_count, 0);
+	uint32_t time = AcmrCacheSize + 1;
+	std::vector<size_t> hard;
+	for( size_t t = 0; t < triangle_count; t++ ){
+		if( simulate_fifo(&indices[t * 3], timestamps, time, AcmrCacheSize) == 3 || t == 0 ){
+			hard.push_back(t);
+		}
+	}
+	hard.push_back(triangle_count);
+
+	// Soft boundaries: split a hard cluster further wherever the run so far, drawn with a cold cache, is still
+	// within threshold of the ACMR of the whole cluster
+	std::vector<triangle_cluster> clusters;
+	for( size_t h = 0; h + 1 < hard.size(); h++ ){
+		size_t start = hard[h], end = hard[h + 1];
+
+		time += AcmrCacheSize + 1;
+		uint32_t cluster_misses = 0;
+		for( size_t t = start; t < end; t++ ){
+			cluster_misses += simulate_fifo(&indices[t * 3], timestamps, time, AcmrCacheSize);
+		}
+		float cluster_acmr = (float)cluster_misses / (end - start);
+
+		time += AcmrCacheSize + 1;
+		size_t cluster_start = start;
+		uint32_t misses = 0;
+		for( size_t t = start; t < end; t++ ){
+			misses += simulate_fifo(&indices[t * 3], timestamps, time, AcmrCacheSize);
+			size_t run = t + 1 - cluster_start;
+			if( t + 1 == end || (run >= MinClusterTriangles && misses <= cluster_acmr * threshold * run) ){
+				triangle_cluster cluster = {cluster_start, t + 1, 0.0f};
+				clusters.push_back(cluster);
+				cluster_start = t + 1;
+				misses = 0;
+				time += AcmrCacheSize + 1;
+			}
+		}
+	}
+	if( clusters.size() < 2 ){
+		return;
+	}
+
+	// Area weighted centroid and normal of each cluster and of the whole mesh
+	std::vector<float> centroids(clusters.size() * 3, 0.0f);
+	std::vector<float> normals(clusters.size() * 3, 0.0f);
+	float mesh_centroid[3] = {0.0f, 0.0f, 0.0f};
+	float mesh_area = 0.0f;
+	for( size_t c = 0; c < clusters.size(); c++ ){
+		float area_sum = 0.0f;
+		for( size_t t = clusters[c].start; t < clusters[c].end; t++ ){
+			const float * p0 = positions + indices[t * 3] * stride;
+			const float * p1 = positions + indices[t * 3 + 1] * stride;
+			const float * p2 = positions + indices[t * 3 + 2] * stride;
+			float e1[3] = {p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2]};
+			float e2[3] = {p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2]};
+			float n[3] = {e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0]};
+			float area = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+
+			for( int k = 0; k < 3; k++ ){
+				float center = (p0[k] + p1[k] + p2[k]) * (1.0f / 3.0f);
+				centroids[c * 3 + k] += center * area;
+				mesh_centroid[k] += center * area;
+				normals[c * 3 + k] += n[k];
+			}
+			area_sum += area;
+		}
+		for( int k = 0; k < 3 && area_sum > 0.0f; k++ ){
+			centroids[c * 3 + k] /= area_sum;
+		}
+		mesh_area += area_sum;
+	}
+	if( mesh_area <= 0.0f ){
+		return;
+	}
+	for( int k = 0; k < 3; k++ ){
+		mesh_centroid[k] /= mesh_area;
+	}
+
+	// Clusters further out along their own normal occlude the rest, so they go first
+	for( size_t c = 0; c < clusters.size(); c++ ){
+		const float * n = &normals[c * 3];
+		float length = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+		float key = 0.0f;
+		for( int k = 0; k < 3 && length > 0.0f; k++ ){
+			key += (centroids[c * 3 + k] - mesh_centroid[k]) * n[k] / length;
+		}
+		clusters[c].sort_key = key;
+	}
+	std::stable_sort(clusters.begin(), clusters.end(), [](const triangle_cluster & a, const triangle_cluster & b){
+		return a.sort_key > b.sort_key;
+	});
+
+	std::vector<uint32_t> result;
+	result.reserve(triangle_count * 3);
+	for( size_t c = 0; c < clusters.size(); c++ ){
+		result.insert(result.end(), indices + clusters[c].start * 3, indices + clusters[c].end * 3);
+	}
+
+	// Keep the input order if splitting cost more vertex cache efficiency than allowed
+	if( compute_acmr(result.data(), result.size(), vertex_count, AcmrCacheSize) <= input_acmr * threshold ){
+		memcpy(indices, result.data(), result.size() * sizeof(uint32_t));
+	}
+}
+
+size_t optimize_vertex_fetch(uint32_t * indices, size_t index_count, size_t vertex_count, std::vector<uint32_t> & remap){
+	remap.assign(vertex_count, NoVertex);
+
+	uint32_t next = 0;
+	for( size_t i = 0; i < index_count; i++ ){
+		uint32_t & slot = remap[indices[i]];
+		if( slot == NoVertex ){
+			slot = next++;
+		}
+		indices[i] = slot;
+	}
+	return next;
+}
+
+// Symmetric 4x4 quadric summing the squared distances to a set of planes, each weighted by its triangle's area
+struct quadric {
+	double a00, a11, a22, a01, a02, a12;
+	double b0, b1, b2;
+	double c;
+	double weight;
+};
+
+static void quadric_add(quadric & q, const quadric & other){
+	q.a00 += other.a00; q.a11 += other.a11; q.a22 += other.a22;
+	q.a01 += other.a01; q.a02 += other.a02; q.a12 += other.a12;
+	q.b0 += other.b0; q.b1 += other.b1; q.b2 += other.b2;
+	q.c += other.c;
+	q.weight += other.weight;
+}
+
+// Mean squared distance of the point p to the planes of q
+static double quadric_error(const quadric & q, const float * p){
+	double x = p[0], y = p[1], z = p[2];
+	double rx = q.a00 * x + q.a01 * y + q.a02 * z;
+	double ry = q.a01 * x + q.a11 * y + q.a12 * z;
+	double rz = q.a02 * x + q.a12 * y + q.a22 * z;
+	double error = x * rx + y * ry + z * rz + 2.0 * (q.b0 * x + q.b1 * y + q.b2 * z) + q.c;
+	return q.weight > 0.0 ? fabs(error) / q.weight : 0.0;
+}
+
+static void triangle_normal(const float * p0, const float * p1, const float * p2, double * n){
+	double e1[3] = {p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2]};
+	double e2[3] = {p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2]};
+	n[0] = e1[1] * e2[2] - e1[2] * e2[1];
+	n[1] = e1[2] * e2[0] - e1[0] * e2[2];
+	n[2] = e1[0] * e2[1] - e1[1] * e2[0];
+}
+
+struct edge_collapse {
+	uint32_t from;
+	uint32_t to;
+	double cost;
+};
+
+size_t simplify_mesh(uint32_t * destination, const uint32_t * indices, size_t index_count, const float * positions, size_t stride,
+	size_t vertex_count, size_t target_index_count, float & error){
+	error = 0.0f;
+	index_count -= index_count % 3;
+	if( destination != indices ){
+		memmove(destination, indices, index_count * sizeof(uint32_t));
+	}
+	if( index_count <= target_index_count ){
+		return index_count;
+	}
+
+	// Vertices at the same position share one quadric. A position with several vertices is an attribute seam.
+	std::vector<float> points(vertex_count * 3);
+	for( size_t v = 0; v < vertex_count; v++ ){
+		memcpy(&points[v * 3], positions + v * stride, 3 * sizeof(float));
+	}
+	std::vector<uint32_t> position_of;
+	size_t position_count = weld_vertices(points.data(), vertex_count, 3, position_of);
+	std::vector<uint32_t> position_vertices(position_count, 0);
+	for( size_t v = 0; v < vertex_count; v++ ){
+		position_vertices[position_of[v]]++;
+	}
+
+	// Seams and open edges (an edge with no twin going the other way) stay in place, so the outline of the
+	// mesh and the borders between attribute regions keep their shape
+	std::vector<char> locked_position(position_count, 0);
+	for( size_t p = 0; p < position_count; p++ ){
+		locked_position[p] = position_vertices[p] > 1;
+	}
+	std::vector<uint64_t> edges;
+	edges.reserve(index_count);
+	for( size_t i = 0; i < index_count; i += 3 ){
+		for( int k = 0; k < 3; k++ ){
+			uint64_t a = position_of[destination[i + k]], b = position_of[destination[i + (k + 1) % 3]];
+			edges.push_back(a << 32 | b);
+		}
+	}
+	std::sort(edges.begin(), edges.end());
+	for( size_t e = 0; e < edges.size(); e++ ){
+		uint64_t twin = edges[e] << 32 | edges[e] >> 32;
+		if( !std::binary_search(edges.begin(), edges.end(), twin) ){
+			locked_position[edges[e] >> 32] = 1;
+			locked_position[edges[e] & 0xffffffffu] = 1;
+		}
+	}
+
+	std::vector<quadric> quadrics(position_count);
+	memset(quadrics.data(), 0, position_count * sizeof(quadric));
+	for( size_t i = 0; i < index_count; i += 3 ){
+		const float * p0 = &points[destination[i] * 3];
+		double n[3];
+		triangle_normal(p0, &points[destination[i + 1] * 3], &points[destination[i + 2] * 3], n);
+		double length = sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+		if( length <= 0.0 ){
+			continue;
+		}
+		for( int k = 0; k < 3; k++ ){
+			n[k] /= length;
+		}
+
+		// Plane n.p + d = 0 weighted by area: error w * (n.p + d)^2
+		double d = -(n[0] * p0[0] + n[1] * p0[1] + n[2] * p0[2]);
+		double w = length * 0.5;
+		quadric plane = {w * n[0] * n[0], w * n[1] * n[1], w * n[2] * n[2], w * n[0] * n[1], w * n[0] * n[2], w * n[1] * n[2],
+			w * n[0] * d, w * n[1] * d, w * n[2] * d, w * d * d, w};
+		for( int k = 0; k < 3; k++ ){
+			quadric_add(quadrics[position_of[destination[i + k]]], plane);
+		}
+	}
+
+	// Passes of independent collapses, cheapest first, until the target is reached or nothing can collapse
+	std::vector<uint32_t> first_triangle(vertex_count + 1);
+	std::vector<uint32_t> vertex_triangles;
+	std::vector<uint32_t> remap(vertex_count);
+	std::vector<char> touched(vertex_count);
+	std::vector<edge_collapse> collapses;
+	double max_cost = 0.0;
+
+	while( index_count > target_index_count ){
+		// Triangles around each vertex
+		std::fill(first_triangle.begin(), first_triangle.end(), 0);
+		for( size_t i = 0; i < index_count; i++ ){
+			first_triangle[destination[i] + 1]++;
+		}
+		for( size_t v = 0; v < vertex_count; v++ ){
+			first_triangle[v + 1] += first_triangle[v];
+		}
+		vertex_triangles.resize(index_count);
+		std::vector<uint32_t> fill(first_triangle.begin(), first_triangle.end() - 1);
+		for( size_t i = 0; i < index_count; i++ ){
+			vertex_triangles[fill[destination[i]]++] = (uint32_t)(i / 3);
+		}
+
+		// Candidates: every edge once (from the triangle where it runs from the lower vertex to the higher, edges
+		// with no such triangle are open and locked), collapsing in the cheaper direction that moves a free vertex
+		collapses.clear();
+		for( size_t i = 0; i < index_count; i += 3 ){
+			for( int k = 0; k < 3; k++ ){
+				uint32_t a = destination[i + k], b = destination[i + (k + 1) % 3];
+				if( a > b || position_of[a] == position_of[b] ){
+					continue;
+				}
+				quadric combined = quadrics[position_of[a]];
+				quadric_add(combined, quadrics[position_of[b]]);
+				edge_collapse onto_b = {a, b, quadric_error(combined, &points[b * 3])};
+				edge_collapse onto_a = {b, a, quadric_error(combined, &points[a * 3])};
+				bool a_free = !locked_position[position_of[a]], b_free = !locked_position[position_of[b]];
+				if( a_free && (!b_free || onto_b.cost <= onto_a.cost) ){
+					collapses.push_back(onto_b);
+				} else if( b_free ){
+					collapses.push_back(onto_a);
+				}
+			}
+		}
+		if( collapses.empty() ){
+			break;
+		}
+		std::sort(collapses.begin(), collapses.end(), [](const edge_collapse & x, const edge_collapse & y){
+			return x.cost < y.cost;
+		});
+
+		// Only the cheaper part of the candidates is tried in one pass, the rest are costed again after it
+		double pass_limit = collapses[collapses.size() / 3].cost;
+		size_t triangles_to_remove = (index_count - target_index_count + 2) / 3;
+		size_t removed = 0;
+		for( size_t v = 0; v < vertex_count; v++ ){
+			remap[v] = (uint32_t)v;
+		}
+		std::fill(touched.begin(), touched.end(), 0);
+
+		for( size_t c = 0; c < collapses.size() && removed < triangles_to_remove; c++ ){
+			const edge_collapse & collapse = collapses[c];
+			if( collapse.cost > pass_limit && removed > 0 ){
+				break;
+			}
+			if( touched[collapse.from] || touched[collapse.to] ){
+				continue;
+			}
+
+			// Moving from onto to must not flip any remaining triangle around from
+			bool flips = false;
+			size_t collapsed_triangles = 0;
+			for( uint32_t t = first_triangle[collapse.from]; t < first_triangle[collapse.from + 1] && !flips; t++ ){
+				const uint32_t * triangle = &destination[vertex_triangles[t] * 3];
+				if( triangle[0] == collapse.to || triangle[1] == collapse.to || triangle[2] == collapse.to ){
+					collapsed_triangles++;
+					continue;
+				}
+				const float * before[3];
+				const float * after[3];
+				for( int k = 0; k < 3; k++ ){
+					before[k] = &points[triangle[k] * 3];
+					after[k] = triangle[k] == collapse.from ? &points[collapse.to * 3] : before[k];
+				}
+				double n0[3], n1[3];
+				triangle_normal(before[0], before[1], before[2], n0);
+				triangle_normal(after[0], after[1], after[2], n1);
+				double dot = n0[0] * n1[0] + n0[1] * n1[1] + n0[2] * n1[2];
+				double lengths = sqrt((n0[0] * n0[0] + n0[1] * n0[1] + n0[2] * n0[2]) * (n1[0] * n1[0] + n1[1] * n1[1] + n1[2] * n1[2]));
+				flips = dot <= 0.25 * lengths;
+			}
+			if( flips ){
+				continue;
+			}
+
+			// Later collapses in this pass must not see the triangles around from, which are about to change
+			for( uint32_t t = first_triangle[collapse.from]; t < first_triangle[collapse.from + 1]; t++ ){
+				const uint32_t * triangle = &destination[vertex_triangles[t] * 3];
+				touched[triangle[0]] = touched[triangle[1]] = touched[triangle[2]] = 1;
+			}
+			remap[collapse.from] = collapse.to;
+			quadric_add(quadrics[position_of[collapse.to]], quadrics[position_of[collapse.from]]);
+			max_cost = std::max(max_cost, collapse.cost);
+			removed += collapsed_triangles;
+		}
+		if( removed == 0 ){
+			break;
+		}
+
+		// Apply the collapses and drop the triangles that became degenerate
+		size_t write = 0;
+		for( size_t i = 0; i < index_count; i += 3 ){
+			uint32_t a = remap[destination[i]], b = remap[destination[i + 1]], c = remap[destination[i + 2]];
+			if( a != b && b != c && c != a ){
+				destination[write++] = a;
+				destination[write++] = b;
+				destination[write++] = c;
+			}
+		}
+		index_count = write;
+	}
+
+	error = (float)sqrt(max_cost);
+	return index_count;
+}
@@ -0,0 +1,60 @@
+#ifndef MESHOPT_H
+#define MESHOPT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+// Processing of triangle lists into indexed meshes that are cheap for the GPU to draw:
+//
+//   weld_vertices           merge identical vertices, turning a triangle soup into an index buffer
+//   optimize_vertex_cache   reorder triangles so vertices are reused while still in the post-transform cache
+//   optimize_overdraw       reorder clusters of triangles so outward facing ones are drawn first
+//   optimize_vertex_fetch   reorder vertices in the order the indices first use them
+//   simplify_mesh           collapse edges in order of quadric error, for coarser levels of detail
+//
+// Vertices are given as arrays of floats, stride floats per vertex.
+
+// Post-transform cache size assumed by the optimizer, and the FIFO cache size used to measure the result
+static const size_t VertexCacheSize = 32;
+static const size_t AcmrCacheSize = 16;
+
+// Fills remap with the welded index of every input vertex (numbered in order of first occurrence) and returns
+// the number of unique vertices. Vertices are equal when all their floats are (0 and -0 are treated as equal).
+size_t weld_vertices(const float * vertices, size_t count, size_t stride, std::vector<uint32_t> & remap);
+
+// Reorders the triangles of an index buffer for the post-transform vertex cache (Forsyth's linear-speed algorithm)
+void optimize_vertex_cache(uint32_t * indices, size_t index_count, size_t vertex_count);
+
+// Reorders clusters of cache optimized triangles front to back, as seen from outside the mesh, accepting at most
+// threshold times the ACMR of the input. positions are the first three floats of each vertex.
+void optimize_overdraw(uint32_t * indices, size_t index_count, const float * positions, size_t stride, size_t vertex_count, float threshold);
+
+// Renumbers vertices in the order the indices first refer to them. Fills remap with the new index of every old
+// vertex (~0u if unused) and returns the number of vertices used.
+size_t optimize_vertex_fetch(uint32_t * indices, size_t index_count, size_t vertex_count, std::vector<uint32_t> & remap);
+
+// Average cache miss ratio: transformed vertices per triangle with a FIFO cache of cache_size entries (0.5 to 3)
+float compute_acmr(const uint32_t * indices, size_t index_count, size_t vertex_count, size_t cache_size);
+
+// Writes to destination (room for index_count indices, may be indices itself) a coarser version of a triangle list
+// with about target_index_count indices or more, made by collapsing edges in order of quadric error (Garland and
+// Heckbert). Collapses only move a vertex onto another, so every level keeps using the input's vertex buffer.
+// Vertices on open edges or sharing their position with another vertex (attribute seams) are never moved.
+// Returns the index count and sets error to the largest RMS distance of a collapse from the planes it replaced.
+size_t simplify_mesh(uint32_t * destination, const uint32_t * indices, size_t index_count, const float * positions, size_t stride,
+	size_t vertex_count, size_t target_index_count, float & error);
+
+// Copies the vertices into the order given by remap (as returned by weld_vertices or optimize_vertex_fetch)
+template <typename T>
+void remap_vertices(std::vector<T> & vertices, const std::vector<uint32_t> & remap, size_t unique_count){
+	std::vector<T> result(unique_count);
+	for( size_t i = 0; i < remap.size() && i < vertices.size(); i++ ){
+		if( remap[i] != ~0u ){
+			result[remap[i]] = vertices[i];
+		}
+	}
+	vertices.swap(result);
+}
+
+#endif
@@ -0,0 +1,82 @@
+#ifndef MPSCQUEUE_H
+#define MPSCQUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+// Lock-free multiple producer / single consumer queue.
+// Any number of threads push() values; a single consumer takes everything queued so far
+// with drain(), in the order it was pushed. Producers only ever compete on one atomic
+// pointer and the consumer swaps the whole list out at once, so neither side waits.
+template <typename T>
+class mpsc_queue {
+public:
+	mpsc_queue() : head(nullptr) {}
+
+	~mpsc_queue(){
+		node* list = head.load(std::memory_order_acquire);
+		while (list){
+			node* next = list->next;
+			delete list;
+			list = next;
+		}
+	}
+
+	// Producer side, safe to call from any thread
+	void push(const T& value){
+		link(new node(value));
+	}
+
+	void push(T&& value){
+		link(new node(std::move(value)));
+	}
+
+	// Consumer side. Appends all queued values to out, oldest first, and returns how many there were.
+	size_t drain(std::vector<T>& out){
+		node* list = head.exchange(nullptr, std::memory_order_acquire);
+
+		// The list is linked newest first, reverse it
+		node* oldest = nullptr;
+		while (list){
+			node* next = list->next;
+			list->next = oldest;
+			oldest = list;
+			list = next;
+		}
+
+		size_t count = 0;
+		while (oldest){
+			node* next = oldest->next;
+			out.push_back(std::move(oldest->value));
+			delete oldest;
+			oldest = next;
+			count++;
+		}
+		return count;
+	}
+
+	bool empty() const { return head.load(std::memory_order_relaxed) == nullptr; }
+
+private:
+	struct node {
+		T value;
+		node* next;
+		node(const T& v) : value(v), next(nullptr) {}
+		node(T&& v) : value(std::move(v)), next(nullptr) {}
+	};
+
+	void link(node* n){
+		n->next = head.load(std::memory_order_relaxed);
+		while (!head.compare_exchange_weak(n->next, n, std::memory_order_release, std::memory_order_relaxed)){
+		}
+	}
+
+	mpsc_queue(const mpsc_queue&);
+	mpsc_queue& operator=(const mpsc_queue&);
+
+	std::atomic<node*> head;	// Most recently pushed node
+};
+
+#endif
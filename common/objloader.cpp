@@ -1,110 +1,486 @@
 #include <vector>
 #include <stdio.h>
+#include <stdint.h>
 #include <string>
 #include <cstring>
+#include <chrono>
+#include <thread>
 
 #include "objloader.h"
+#include "mappedfile.h"
 
-// Very, VERY simple OBJ loader.
-// Here is a short list of features a real function would provide : 
-// - Binary files. Reading a model should be just a few memcpy's away, not parsing a file at runtime. In short : OBJ is not very great.
-// - Animations & bones (includes bones weights)
-// - Multiple UVs
-// - All attributes should be optional, not "forced"
-// - More stable. Change a line in the OBJ file and it crashes.
-// - More secure. Change another line and you can inject code.
-// - Loading from memory, stream, etc
+// OBJ loader for the geometry used by the program: positions, texture coordinates and normals.
+// The file is memory mapped and split at line boundaries into chunks that are parsed in parallel
+// (on their own thread each when the file is large enough), in three passes:
+//   1. count the vertices, texture coordinates, normals and triangles of each chunk,
+//      so every array can be sized exactly and each chunk knows where its data goes;
+//   2. parse each chunk straight into its slice of those arrays;
+//   3. expand the triangle corners into the output arrays (once all attributes are known,
+//      as faces may refer to any of them).
+// Faces can have any number of corners (they are split into a fan of triangles), and texture
+// coordinates and normals are optional: missing texture coordinates are zero, and corners without
+// a normal get the normal of their triangle. Materials, groups and everything else are ignored.
+
+// Files below this size per chunk are not split further
+static const size_t MinChunkSize = 256 * 1024;
+
+// Corner of a triangle as 0-based indices into the parsed arrays, -1 where not given
+struct obj_corner {
+	int v, vt, vn;
+};
+
+struct obj_chunk {
+	const char * begin;
+	const char * end;
+
+	// Pass 1 counts, then (after the prefix sums) where the chunk's data starts in the shared arrays
+	size_t num_vertices, num_uvs, num_normals, num_triangles;
+	size_t first_vertex, first_uv, first_normal, first_triangle;
+
+	int error_line;			// First line that could not be parsed (1-based within the chunk), 0 if none
+	bool range_error;		// A face refers to an attribute that does not exist
+};
+
+struct obj_data {
+	std::vector<vmath::vec3> vertices;
+	std::vector<vmath::vec2> uvs;
+	std::vector<vmath::vec3> normals;
+	std::vector<obj_corner> corners;		// Three per triangle
+};
+
+static inline bool is_space(char c){
+	return c == ' ' || c == '\t' || c == '\r';
+}
+
+static inline bool is_digit(char c){
+	return c >= '0' && c <= '9';
+}
+
+static inline const char * skip_space(const char * p, const char * end){
+	while( p < end && is_space(*p) ){
+		p++;
+	}
+	return p;
+}
+
+static inline const char * next_line(const char * p, const char * end){
+	const char * newline = (const char *)memchr(p, '\n', end - p);
+	return newline ? newline + 1 : end;
+}
+
+// Parses a decimal floating point number such as -1.25, 3 or 4.5e-3. Returns the position after
+// it, or NULL if there is no number at p.
+static const char * parse_float(const char * p, const char * end, float & value){
+	static const double powers[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+		1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+	bool negative = false;
+	if( p < end && (*p == '-' || *p == '+') ){
+		negative = *p == '-';
+		p++;
+	}
+
+	// Up to 19 significant digits fit in the mantissa, further ones only shift the exponent
+	uint64_t mantissa = 0;
+	int digits = 0;
+	int exponent = 0;
+	bool any_digit = false;
+	while( p < end && is_digit(*p) ){
+		if( digits < 19 ){
+			mantissa = mantissa * 10 + (*p - '0');
+			digits += mantissa != 0;
+		}else{
+			exponent++;
+		}
+		any_digit = true;
+		p++;
+	}
+	if( p < end && *p == '.' ){
+		p++;
+		while( p < end && is_digit(*p) ){
+			if( digits < 19 ){
+				mantissa = mantissa * 10 + (*p - '0');
+				digits += mantissa != 0;
+				exponent--;
+			}
+			any_digit = true;
+			p++;
+		}
+	}
+	if( !any_digit ){
+		return NULL;
+	}
+
+	if( p < end && (*p == 'e' || *p == 'E') ){
+		const char * q = p + 1;
+		bool negative_exponent = false;
+		if( q < end && (*q == '-' || *q == '+') ){
+			negative_exponent = *q == '-';
+			q++;
+		}
+		if( q < end && is_digit(*q) ){
+			int e = 0;
+			while( q < end && is_digit(*q) ){
+				if( e < 10000 ){
+					e = e * 10 + (*q - '0');
+				}
+				q++;
+			}
+			exponent += negative_exponent ? -e : e;
+			p = q;
+		}
+	}
+
+	double result = (double)mantissa;
+	while( exponent > 22 ){
+		result *= 1e22;
+		exponent -= 22;
+	}
+	while( exponent < -22 ){
+		result /= 1e22;
+		exponent += 22;
+	}
+	result = exponent >= 0 ? result * powers[exponent] : result / powers[-exponent];
+
+	value = (float)(negative ? -result : result);
+	return p;
+}
+
+// Parses a (possibly negative) integer. Returns the position after it, or NULL if there is none.
+static const char * parse_int(const char * p, const char * end, long & value){
+	bool negative = false;
+	if( p < end && (*p == '-' || *p == '+') ){
+		negative = *p == '-';
+		p++;
+	}
+	if( p >= end || !is_digit(*p) ){
+		return NULL;
+	}
+	long result = 0;
+	while( p < end && is_digit(*p) ){
+		result = result * 10 + (*p - '0');
+		p++;
+	}
+	value = negative ? -result : result;
+	return p;
+}
+
+// Turns an OBJ index (1-based, or negative to count back from the last one defined so far) into a
+// 0-based one. Returns -1 for index 0, which OBJ does not allow.
+static inline int resolve_index(long index, size_t defined_so_far){
+	if( index > 0 ){
+		return (int)(index - 1);
+	}
+	if( index < 0 ){
+		return (int)((long)defined_so_far + index);
+	}
+	return -1;
+}
+
+// Kinds of lines the loader cares about
+enum obj_line {LineVertex, LineUV, LineNormal, LineFace, LineOther};
+
+static inline obj_line line_type(const char * p, const char * end){
+	if( end - p >= 2 && p[0] == 'v' ){
+		if( is_space(p[1]) ) return LineVertex;
+		if( end - p >= 3 && is_space(p[2]) ){
+			if( p[1] == 't' ) return LineUV;
+			if( p[1] == 'n' ) return LineNormal;
+		}
+	}else if( end - p >= 2 && p[0] == 'f' && is_space(p[1]) ){
+		return LineFace;
+	}
+	return LineOther;
+}
+
+// Pass 1: counts what the chunk defines
+static void count_chunk(obj_chunk & chunk){
+	chunk.num_vertices = chunk.num_uvs = chunk.num_normals = chunk.num_triangles = 0;
+
+	for( const char * line = chunk.begin; line < chunk.end; ){
+		const char * line_end = next_line(line, chunk.end);
+		const char * p = skip_space(line, line_end);
+
+		switch( line_type(p, line_end) ){
+		case LineVertex: chunk.num_vertices++; break;
+		case LineUV: chunk.num_uvs++; break;
+		case LineNormal: chunk.num_normals++; break;
+		case LineFace: {
+			// Count the corners, separated by white space
+			size_t corners = 0;
+			p = skip_space(p + 1, line_end);
+			while( p < line_end && *p != '\n' && *p != '#' ){
+				corners++;
+				while( p < line_end && !is_space(*p) && *p != '\n' ){
+					p++;
+				}
+				p = skip_space(p, line_end);
+			}
+			if( corners >= 3 ){
+				chunk.num_triangles += corners - 2;
+			}
+			break;
+		}
+		default: break;
+		}
+		line = line_end;
+	}
+}
+
+// Reads one face corner: v, v/vt, v//vn or v/vt/vn
+static const char * parse_corner(const char * p, const char * end, const obj_chunk & chunk, size_t vertices, size_t uvs, size_t normals, obj_corner & corner){
+	long index;
+	p = parse_int(p, end, index);
+	if( !p ){
+		return NULL;
+	}
+	corner.v = resolve_index(index, chunk.first_vertex + vertices);
+	corner.vt = -1;
+	corner.vn = -1;
+
+	if( p < end && *p == '/' ){
+		p++;
+		if( p < end && *p != '/' ){
+			p = parse_int(p, end, index);
+			if( !p ){
+				return NULL;
+			}
+			corner.vt = resolve_index(index, chunk.first_uv + uvs);
+		}
+		if( p < end && *p == '/' ){
+			p = parse_int(p + 1, end, index);
+			if( !p ){
+				return NULL;
+			}
+			corner.vn = resolve_index(index, chunk.first_normal + normals);
+		}
+	}
+	return p;
+}
+
+// Pass 2: parses the chunk into its slices of the shared arrays
+static void parse_chunk(obj_chunk & chunk, obj_data & data){
+	size_t vertices = 0, uvs = 0, normals = 0, triangles = 0;
+	int line_number = 0;
+	chunk.error_line = 0;
+
+	for( const char * line = chunk.begin; line < chunk.end && chunk.error_line == 0; ){
+		const char * line_end = next_line(line, chunk.end);
+		const char * p = skip_space(line, line_end);
+		line_number++;
+
+		bool ok = true;
+		switch( line_type(p, line_end) ){
+		case LineVertex: {
+			vmath::vec3 & vertex = data.vertices[chunk.first_vertex + vertices++];
+			p += 1;
+			for( int i = 0; i < 3 && ok; i++ ){
+				p = parse_float(skip_space(p, line_end), line_end, vertex[i]);
+				ok = p != NULL;
+			}
+			break;
+		}
+		case LineUV: {
+			vmath::vec2 & uv = data.uvs[chunk.first_uv + uvs++];
+			p += 2;
+			for( int i = 0; i < 2 && ok; i++ ){
+				p = parse_float(skip_space(p, line_end), line_end, uv[i]);
+				ok = p != NULL;
+			}
+			uv[1] = -uv[1]; // Invert V coordinate since we will only use DDS texture, which are inverted. Remove if you want to use TGA or BMP loaders.
+			break;
+		}
+		case LineNormal: {
+			vmath::vec3 & normal = data.normals[chunk.first_normal + normals++];
+			p += 2;
+			for( int i = 0; i < 3 && ok; i++ ){
+				p = parse_float(skip_space(p, line_end), line_end, normal[i]);
+				ok = p != NULL;
+			}
+			break;
+		}
+		case LineFace: {
+			// Split the polygon into a fan of triangles around its first corner
+			obj_corner first, previous, corner;
+			int count = 0;
+			p = skip_space(p + 1, line_end);
+			while( ok && p < line_end && *p != '\n' && *p != '#' ){
+				p = parse_corner(p, line_end, chunk, vertices, uvs, normals, corner);
+				ok = p != NULL;
+				if( !ok ){
+					break;
+				}
+				if( count == 0 ){
+					first = corner;
+				}else if( count >= 2 ){
+					obj_corner * triangle = &data.corners[3 * (chunk.first_triangle + triangles++)];
+					triangle[0] = first;
+					triangle[1] = previous;
+					triangle[2] = corner;
+				}
+				previous = corner;
+				count++;
+				p = skip_space(p, line_end);
+			}
+			break;
+		}
+		default: break;
+		}
+
+		if( !ok ){
+			chunk.error_line = line_number;
+		}
+		line = line_end;
+	}
+}
+
+// Pass 3: looks up the attributes of every corner of the chunk's triangles
+static void expand_chunk(obj_chunk & chunk, const obj_data & data, size_t out_base, std::vector<vmath::vec4> & out_vertices, std::vector<vmath::vec2> & out_uvs, std::vector<vmath::vec3> & out_normals){
+	const int num_vertices = (int)data.vertices.size();
+	const int num_uvs = (int)data.uvs.size();
+	const int num_normals = (int)data.normals.size();
+	chunk.range_error = false;
+
+	for( size_t t = chunk.first_triangle; t < chunk.first_triangle + chunk.num_triangles; t++ ){
+		const obj_corner * triangle = &data.corners[3 * t];
+		size_t out = out_base + 3 * t;
+
+		for( int i = 0; i < 3; i++ ){
+			const obj_corner & corner = triangle[i];
+			if( corner.v < 0 || corner.v >= num_vertices || corner.vt >= num_uvs || corner.vn >= num_normals || corner.vt < -1 || corner.vn < -1 ){
+				chunk.range_error = true;
+				return;
+			}
+			out_vertices[out + i] = vmath::vec4(data.vertices[corner.v], 1.0f);
+			out_uvs[out + i] = corner.vt >= 0 ? data.uvs[corner.vt] : vmath::vec2(0.0f, 0.0f);
+		}
+
+		// Corners without a normal use the one of the triangle
+		vmath::vec3 face_normal(0.0f, 0.0f, 0.0f);
+		if( triangle[0].vn < 0 || triangle[1].vn < 0 || triangle[2].vn < 0 ){
+			vmath::vec3 a = data.vertices[triangle[0].v];
+			vmath::vec3 b = data.vertices[triangle[1].v];
+			vmath::vec3 c = data.vertices[triangle[2].v];
+			face_normal = vmath::cross(b - a, c - a);
+			float length = vmath::length(face_normal);
+			if( length > 0.0f ){
+				face_normal = face_normal * (1.0f / length);
+			}
+		}
+		for( int i = 0; i < 3; i++ ){
+			out_normals[out + i] = triangle[i].vn >= 0 ? data.normals[triangle[i].vn] : face_normal;
+		}
+	}
+}
+
+// Runs work(i) for every chunk, on a thread each when there is more than one
+template <typename F>
+static void for_each_chunk(size_t count, F work){
+	if( count == 1 ){
+		work(0);
+		return;
+	}
+	std::vector<std::thread> threads;
+	for( size_t i = 0; i < count; i++ ){
+		threads.push_back(std::thread(work, i));
+	}
+	for( size_t i = 0; i < threads.size(); i++ ){
+		threads[i].join();
+	}
+}
 
 bool loadOBJ(
-	const char * path, 
+	const char * path,
 	std::vector<vmath::vec4> & out_vertices,
 	std::vector<vmath::vec2> & out_uvs,
 	std::vector<vmath::vec3> & out_normals
 ){
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
 
-	std::vector<unsigned int> vertexIndices, uvIndices, normalIndices;
-	std::vector<vmath::vec3> temp_vertices;
-	std::vector<vmath::vec2> temp_uvs;
-	std::vector<vmath::vec3> temp_normals;
+	mapped_file file;
+	if( !file.open(path) ){
+		printf("Impossible to open the file %s ! Are you in the right path ?\n", path);
+		return false;
+	}
+	const char * text = (const char *)file.data();
+	const char * text_end = text + file.size();
 
+	// Split the file into chunks of whole lines
+	size_t num_chunks = file.size() / MinChunkSize;
+	size_t max_chunks = std::thread::hardware_concurrency();
+	if( num_chunks > max_chunks ) num_chunks = max_chunks;
+	if( num_chunks < 1 ) num_chunks = 1;
 
-	FILE * file = fopen(path, "r");
-	if( file == NULL ){
-		printf("Impossible to open the file ! Are you in the right path ? See Tutorial 1 for details\n");
-		getchar();
-		return false;
+	std::vector<obj_chunk> chunks(num_chunks);
+	const char * chunk_begin = text;
+	for( size_t i = 0; i < num_chunks; i++ ){
+		const char * chunk_end = i + 1 == num_chunks ? text_end : text + file.size() * (i + 1) / num_chunks;
+		if( chunk_end < chunk_begin ){
+			chunk_end = chunk_begin;
+		}else if( chunk_end < text_end ){
+			chunk_end = next_line(chunk_end, text_end);
+		}
+		chunks[i].begin = chunk_begin;
+		chunks[i].end = chunk_end;
+		chunk_begin = chunk_end;
 	}
 
-	while( 1 ){
+	// Pass 1, then place each chunk's data after the previous chunks'
+	for_each_chunk(num_chunks, [&](size_t i){ count_chunk(chunks[i]); });
 
-		char lineHeader[128];
-		// read the first word of the line
-		int res = fscanf(file, "%s", lineHeader);
-		if (res == EOF)
-			break; // EOF = End Of File. Quit the loop.
+	size_t total_vertices = 0, total_uvs = 0, total_normals = 0, total_triangles = 0;
+	for( size_t i = 0; i < num_chunks; i++ ){
+		chunks[i].first_vertex = total_vertices;
+		chunks[i].first_uv = total_uvs;
+		chunks[i].first_normal = total_normals;
+		chunks[i].first_triangle = total_triangles;
+		total_vertices += chunks[i].num_vertices;
+		total_uvs += chunks[i].num_uvs;
+		total_normals += chunks[i].num_normals;
+		total_triangles += chunks[i].num_triangles;
+	}
 
-		// else : parse lineHeader
-		
-		if ( strcmp( lineHeader, "v" ) == 0 ){
-			vmath::vec3 vertex;
-			fscanf(file, "%f %f %f\n", &vertex[0], &vertex[1], &vertex[2] );
-			temp_vertices.push_back(vertex);
-		}else if ( strcmp( lineHeader, "vt" ) == 0 ){
-			vmath::vec2 uv;
-			fscanf(file, "%f %f\n", &uv[0], &uv[1] );
-			uv[1] = -uv[1]; // Invert V coordinate since we will only use DDS texture, which are inverted. Remove if you want to use TGA or BMP loaders.
-			temp_uvs.push_back(uv);
-		}else if ( strcmp( lineHeader, "vn" ) == 0 ){
-			vmath::vec3 normal;
-			fscanf(file, "%f %f %f\n", &normal[0], &normal[1], &normal[2] );
-			temp_normals.push_back(normal);
-		}else if ( strcmp( lineHeader, "f" ) == 0 ){
-			std::string vertex1, vertex2, vertex3;
-			unsigned int vertexIndex[3], uvIndex[3], normalIndex[3];
-			int matches = fscanf(file, "%d/%d/%d %d/%d/%d %d/%d/%d\n", &vertexIndex[0], &uvIndex[0], &normalIndex[0], &vertexIndex[1], &uvIndex[1], &normalIndex[1], &vertexIndex[2], &uvIndex[2], &normalIndex[2] );
-			if (matches != 9){
-				printf("File can't be read by our simple parser :-( Try exporting with other options\n");
-				fclose(file);
-				return false;
+	// Pass 2
+	obj_data data;
+	data.vertices.resize(total_vertices);
+	data.uvs.resize(total_uvs);
+	data.normals.resize(total_normals);
+	data.corners.resize(3 * total_triangles);
+	for_each_chunk(num_chunks, [&](size_t i){ parse_chunk(chunks[i], data); });
+
+	for( size_t i = 0; i < num_chunks; i++ ){
+		if( chunks[i].error_line ){
+			int line = chunks[i].error_line;
+			for( size_t j = 0; j < i; j++ ){
+				for( const char * p = chunks[j].begin; p < chunks[j].end; p = next_line(p, chunks[j].end) ){
+					line++;
+				}
 			}
-			vertexIndices.push_back(vertexIndex[0]);
-			vertexIndices.push_back(vertexIndex[1]);
-			vertexIndices.push_back(vertexIndex[2]);
-			uvIndices    .push_back(uvIndex[0]);
-			uvIndices    .push_back(uvIndex[1]);
-			uvIndices    .push_back(uvIndex[2]);
-			normalIndices.push_back(normalIndex[0]);
-			normalIndices.push_back(normalIndex[1]);
-			normalIndices.push_back(normalIndex[2]);
-		}else{
-			// Probably a comment, eat up the rest of the line
-			char stupidBuffer[1000];
-			fgets(stupidBuffer, 1000, file);
+			printf("%s:%d: can't read this line\n", path, line);
+			return false;
 		}
-
 	}
 
-	// For each vertex of each triangle
-	for( unsigned int i=0; i<vertexIndices.size(); i++ ){
+	// Pass 3, appending to the output arrays
+	size_t out_base = out_vertices.size();
+	out_vertices.resize(out_base + 3 * total_triangles);
+	out_uvs.resize(out_base + 3 * total_triangles);
+	out_normals.resize(out_base + 3 * total_triangles);
+	for_each_chunk(num_chunks, [&](size_t i){ expand_chunk(chunks[i], data, out_base, out_vertices, out_uvs, out_normals); });
 
-		// Get the indices of its attributes
-		unsigned int vertexIndex = vertexIndices[i];
-		unsigned int uvIndex = uvIndices[i];
-		unsigned int normalIndex = normalIndices[i];
-		
-		// Get the attributes thanks to the index
-		vmath::vec3 vertex = temp_vertices[ vertexIndex-1 ];
-		vmath::vec2 uv = temp_uvs[ uvIndex-1 ];
-		vmath::vec3 normal = temp_normals[ normalIndex-1 ];
-		
-		// Put the attributes in buffers
-		vmath::vec4 temp = vmath::vec4(vertex, 1.0f);
-		out_vertices.push_back(temp);
-		out_uvs     .push_back(uv);
-		out_normals .push_back(normal);
-	
+	for( size_t i = 0; i < num_chunks; i++ ){
+		if( chunks[i].range_error ){
+			printf("%s: a face refers to a vertex, texture coordinate or normal that does not exist\n", path);
+			out_vertices.resize(out_base);
+			out_uvs.resize(out_base);
+			out_normals.resize(out_base);
+			return false;
+		}
 	}
 
-	fclose(file);
+	double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	printf("Loaded %s: %u triangles from %u vertices in %.2f ms (%u chunk%s, %.1f MB/s)\n", path,
+		(unsigned)total_triangles, (unsigned)total_vertices, milliseconds, (unsigned)num_chunks, num_chunks == 1 ? "" : "s",
+		milliseconds > 0.0 ? file.size() / (milliseconds * 1000.0) : 0.0);
 	return true;
 }
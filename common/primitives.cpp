@@ -0,0 +1,288 @@
+#include <math.h>
+#include <stdlib.h>
+
+#include "primitives.h"
+
+const char * const PrimitiveNames[NumPrimitives] = {"cube", "cone", "torus", "cylinder", "sphere"};
+
+// Largest segment or ring count accepted
+static const int MaxTessellation = 1024;
+
+static const float TorusRadius = 1.0f;
+static const float TorusTubeRadius = 0.25f;
+
+// Default and smallest value of each parameter per shape (0 if the shape does not take it)
+struct primitive_info {
+	int segments;
+	int min_segments;
+	int rings;
+	int min_rings;
+};
+
+static const primitive_info Primitives[NumPrimitives] = {
+	{0, 0, 0, 0},		// Cube
+	{32, 3, 0, 0},		// Cone
+	{48, 3, 16, 3},		// Torus
+	{32, 3, 0, 0},		// Cylinder
+	{32, 3, 16, 2}		// Sphere
+};
+
+primitive_parameters default_primitive_parameters(primitive_shape shape){
+	primitive_parameters parameters;
+	parameters.segments = Primitives[shape].segments;
+	parameters.rings = Primitives[shape].rings;
+	return parameters;
+}
+
+bool parse_primitive_key(const std::string & key, primitive_shape & shape, primitive_parameters & parameters){
+	size_t end = key.find(':');
+	std::string name = key.substr(0, end);
+
+	int found = -1;
+	for( int s = 0; s < NumPrimitives; s++ ){
+		if( name == PrimitiveNames[s] ){
+			found = s;
+		}
+	}
+	if( found < 0 ){
+		return false;
+	}
+	shape = (primitive_shape)found;
+	parameters = default_primitive_parameters(shape);
+	const primitive_info & info = Primitives[shape];
+
+	while( end != std::string::npos ){
+		size_t start = end + 1;
+		end = key.find(':', start);
+		std::string field = key.substr(start, end == std::string::npos ? std::string::npos : end - start);
+
+		size_t equals = field.find('=');
+		if( equals == std::string::npos ){
+			return false;
+		}
+		std::string value_text = field.substr(equals + 1);
+		char * value_end;
+		long value = strtol(value_text.c_str(), &value_end, 10);
+		if( value_text.empty() || *value_end != '\0' ){
+			return false;
+		}
+
+		std::string parameter = field.substr(0, equals);
+		if( parameter == "segments" && info.segments && value >= info.min_segments && value <= MaxTessellation ){
+			parameters.segments = (int)value;
+		} else if( parameter == "rings" && info.rings && value >= info.min_rings && value <= MaxTessellation ){
+			parameters.rings = (int)value;
+		} else {
+			return false;
+		}
+	}
+	return true;
+}
+
+std::string primitive_key(primitive_shape shape, const primitive_parameters & parameters){
+	std::string key = PrimitiveNames[shape];
+	if( parameters.segments != Primitives[shape].segments ){
+		key += ":segments=" + std::to_string(parameters.segments);
+	}
+	if( parameters.rings != Primitives[shape].rings ){
+		key += ":rings=" + std::to_string(parameters.rings);
+	}
+	return key;
+}
+
+namespace {
+
+// Collects the vertices and triangles of a mesh being generated
+struct mesh_builder {
+	std::vector<vmath::vec4> & vertices;
+	std::vector<vmath::vec2> & uvs;
+	std::vector<vmath::vec3> & normals;
+	std::vector<uint32_t> & indices;
+
+	uint32_t vertex(float x, float y, float z, float nx, float ny, float nz, float u, float v){
+		vertices.push_back(vmath::vec4(x, y, z, 1.0f));
+		normals.push_back(vmath::vec3(nx, ny, nz));
+		uvs.push_back(vmath::vec2(u, v));
+		return (uint32_t)vertices.size() - 1;
+	}
+
+	void triangle(uint32_t a, uint32_t b, uint32_t c){
+		indices.push_back(a);
+		indices.push_back(b);
+		indices.push_back(c);
+	}
+
+	// Quad of a grid: a and b are consecutive along one direction, a and c along the other, with b - a, c - a
+	// and the outward normal forming a right-handed frame
+	void quad(uint32_t a, uint32_t b, uint32_t c, uint32_t d){
+		triangle(a, b, c);
+		triangle(b, d, c);
+	}
+};
+
+void generate_cube(mesh_builder & mesh){
+	// Normal, then two edge directions whose cross product is the normal
+	static const float faces[6][3][3] = {
+		{{ 1, 0, 0}, {0, 1, 0}, {0, 0, 1}},
+		{{-1, 0, 0}, {0, 0, 1}, {0, 1, 0}},
+		{{ 0, 1, 0}, {0, 0, 1}, {1, 0, 0}},
+		{{ 0,-1, 0}, {1, 0, 0}, {0, 0, 1}},
+		{{ 0, 0, 1}, {1, 0, 0}, {0, 1, 0}},
+		{{ 0, 0,-1}, {0, 1, 0}, {1, 0, 0}}
+	};
+	static const float corners[4][2] = {{-0.5f, -0.5f}, {0.5f, -0.5f}, {-0.5f, 0.5f}, {0.5f, 0.5f}};
+
+	for( int f = 0; f < 6; f++ ){
+		const float * n = faces[f][0];
+		const float * u = faces[f][1];
+		const float * v = faces[f][2];
+		uint32_t first = 0;
+		for( int c = 0; c < 4; c++ ){
+			float p[3];
+			for( int k = 0; k < 3; k++ ){
+				p[k] = 0.5f * n[k] + corners[c][0] * u[k] + corners[c][1] * v[k];
+			}
+			uint32_t index = mesh.vertex(p[0], p[1], p[2], n[0], n[1], n[2], corners[c][0] + 0.5f, corners[c][1] + 0.5f);
+			if( c == 0 ){
+				first = index;
+			}
+		}
+		mesh.quad(first, first + 1, first + 2, first + 3);
+	}
+}
+
+// Flat disc of radius 1 at height y facing up or down
+void generate_cap(mesh_builder & mesh, int segments, float y, bool up){
+	float ny = up ? 1.0f : -1.0f;
+	uint32_t center = mesh.vertex(0.0f, y, 0.0f, 0.0f, ny, 0.0f, 0.5f, 0.5f);
+	uint32_t first = center + 1;
+	for( int s = 0; s <= segments; s++ ){
+		float phi = 2.0f * (float)M_PI * s / segments;
+		mesh.vertex(cosf(phi), y, sinf(phi), 0.0f, ny, 0.0f, 0.5f + 0.5f * cosf(phi), 0.5f + 0.5f * sinf(phi));
+	}
+	for( int s = 0; s < segments; s++ ){
+		if( up ){
+			mesh.triangle(center, first + s + 1, first + s);
+		} else {
+			mesh.triangle(center, first + s, first + s + 1);
+		}
+	}
+}
+
+void generate_cylinder(mesh_builder & mesh, int segments){
+	uint32_t first = (uint32_t)mesh.vertices.size();
+	for( int s = 0; s <= segments; s++ ){
+		float phi = 2.0f * (float)M_PI * s / segments;
+		float u = (float)s / segments;
+		mesh.vertex(cosf(phi), 1.0f, sinf(phi), cosf(phi), 0.0f, sinf(phi), u, 1.0f);
+		mesh.vertex(cosf(phi), -1.0f, sinf(phi), cosf(phi), 0.0f, sinf(phi), u, 0.0f);
+	}
+	for( int s = 0; s < segments; s++ ){
+		uint32_t top = first + 2 * s;
+		mesh.quad(top, top + 2, top + 1, top + 3);
+	}
+
+	generate_cap(mesh, segments, 1.0f, true);
+	generate_cap(mesh, segments, -1.0f, false);
+}
+
+void generate_cone(mesh_builder & mesh, int segments){
+	// The side rises 2 over a run of 1, so its normal leans up by atan(1/2)
+	const float slope = 1.0f / sqrtf(5.0f);
+	const float flat = 2.0f / sqrtf(5.0f);
+
+	uint32_t base = (uint32_t)mesh.vertices.size();
+	for( int s = 0; s <= segments; s++ ){
+		float phi = 2.0f * (float)M_PI * s / segments;
+		mesh.vertex(cosf(phi), -1.0f, sinf(phi), flat * cosf(phi), slope, flat * sinf(phi), (float)s / segments, 0.0f);
+	}
+
+	// One apex vertex per segment, with the normal of the middle of the segment
+	for( int s = 0; s < segments; s++ ){
+		float phi = 2.0f * (float)M_PI * (s + 0.5f) / segments;
+		uint32_t apex = mesh.vertex(0.0f, 1.0f, 0.0f, flat * cosf(phi), slope, flat * sinf(phi), (s + 0.5f) / segments, 1.0f);
+		mesh.triangle(apex, base + s + 1, base + s);
+	}
+
+	generate_cap(mesh, segments, -1.0f, false);
+}
+
+void generate_sphere(mesh_builder & mesh, int segments, int rings){
+	uint32_t first = (uint32_t)mesh.vertices.size();
+	for( int r = 0; r <= rings; r++ ){
+		float theta = (float)M_PI * r / rings;
+		for( int s = 0; s <= segments; s++ ){
+			float phi = 2.0f * (float)M_PI * s / segments;
+			float x = sinf(theta) * cosf(phi);
+			float y = cosf(theta);
+			float z = sinf(theta) * sinf(phi);
+			mesh.vertex(x, y, z, x, y, z, (float)s / segments, 1.0f - (float)r / rings);
+		}
+	}
+
+	// Rows run from the north pole down; the triangles touching a pole would be degenerate
+	for( int r = 0; r < rings; r++ ){
+		for( int s = 0; s < segments; s++ ){
+			uint32_t a = first + r * (segments + 1) + s;
+			uint32_t below = a + segments + 1;
+			if( r > 0 ){
+				mesh.triangle(a, a + 1, below);
+			}
+			if( r < rings - 1 ){
+				mesh.triangle(a + 1, below + 1, below);
+			}
+		}
+	}
+}
+
+void generate_torus(mesh_builder & mesh, int segments, int rings){
+	uint32_t first = (uint32_t)mesh.vertices.size();
+	for( int s = 0; s <= segments; s++ ){
+		float phi = 2.0f * (float)M_PI * s / segments;
+		for( int r = 0; r <= rings; r++ ){
+			float theta = 2.0f * (float)M_PI * r / rings;
+			float nx = cosf(theta) * cosf(phi);
+			float ny = sinf(theta);
+			float nz = cosf(theta) * sinf(phi);
+			mesh.vertex(TorusRadius * cosf(phi) + TorusTubeRadius * nx, TorusTubeRadius * ny, TorusRadius * sinf(phi) + TorusTubeRadius * nz,
+				nx, ny, nz, (float)s / segments, (float)r / rings);
+		}
+	}
+
+	for( int s = 0; s < segments; s++ ){
+		for( int r = 0; r < rings; r++ ){
+			uint32_t a = first + s * (rings + 1) + r;
+			uint32_t next = a + rings + 1;
+			mesh.quad(a, a + 1, next, next + 1);
+		}
+	}
+}
+
+}
+
+void generate_primitive(primitive_shape shape, const primitive_parameters & parameters, std::vector<vmath::vec4> & vertices,
+	std::vector<vmath::vec2> & uvs, std::vector<vmath::vec3> & normals, std::vector<uint32_t> & indices){
+	vertices.clear();
+	uvs.clear();
+	normals.clear();
+	indices.clear();
+	mesh_builder mesh = {vertices, uvs, normals, indices};
+
+	switch( shape ){
+	case PrimitiveCube:
+		generate_cube(mesh);
+		break;
+	case PrimitiveCone:
+		generate_cone(mesh, parameters.segments);
+		break;
+	case PrimitiveTorus:
+		generate_torus(mesh, parameters.segments, parameters.rings);
+		break;
+	case PrimitiveCylinder:
+		generate_cylinder(mesh, parameters.segments);
+		break;
+	default:
+		generate_sphere(mesh, parameters.segments, parameters.rings);
+		break;
+	}
+}
@@ -0,0 +1,43 @@
+#ifndef PRIMITIVES_H
+#define PRIMITIVES_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "vmath.h"
+
+// Procedural meshes of the built-in shapes, at the size of the models they replace:
+//
+//   cube        edge 1, centered
+//   cone        radius 1 at y = -1, apex at y = 1           segments around y
+//   torus       radius 1 around y, tube radius 0.25         segments around y, rings around the tube
+//   cylinder    radius 1, y from -1 to 1                    segments around y
+//   sphere      radius 1                                    segments around y, rings from pole to pole
+//
+// A tessellation is named by a key: the shape name followed by every parameter that differs
+// from the shape's default, e.g. "sphere" or "sphere:segments=24:rings=8".
+
+enum primitive_shape {PrimitiveCube, PrimitiveCone, PrimitiveTorus, PrimitiveCylinder, PrimitiveSphere, NumPrimitives};
+
+extern const char * const PrimitiveNames[NumPrimitives];
+
+struct primitive_parameters {
+	int segments;
+	int rings;
+};
+
+primitive_parameters default_primitive_parameters(primitive_shape shape);
+
+// Parses a key, or a shape name followed by "name=value" parameters separated by ':'. Fails on an unknown
+// shape, a parameter the shape does not take or a value out of range.
+bool parse_primitive_key(const std::string & key, primitive_shape & shape, primitive_parameters & parameters);
+
+// The canonical key of a tessellation
+std::string primitive_key(primitive_shape shape, const primitive_parameters & parameters);
+
+// Builds an indexed triangle list with normals and texture coordinates, wound counter-clockwise seen from outside
+void generate_primitive(primitive_shape shape, const primitive_parameters & parameters, std::vector<vmath::vec4> & vertices,
+	std::vector<vmath::vec2> & uvs, std::vector<vmath::vec3> & normals, std::vector<uint32_t> & indices);
+
+#endif
@@ -0,0 +1,62 @@
+#include "rangealloc.h"
+
+range_allocator::range_allocator(uint32_t capacity) : total(0), allocated(0){
+	grow(capacity);
+}
+
+bool range_allocator::allocate(uint32_t size, uint32_t& offset){
+	if( size == 0 ){
+		offset = 0;
+		return true;
+	}
+
+	for( std::map<uint32_t, uint32_t>::iterator range = free_ranges.begin(); range != free_ranges.end(); ++range ){
+		if( range->second < size ){
+			continue;
+		}
+		offset = range->first;
+		uint32_t rest = range->second - size;
+		free_ranges.erase(range);
+		if( rest > 0 ){
+			free_ranges[offset + size] = rest;
+		}
+		allocated += size;
+		return true;
+	}
+	return false;
+}
+
+void range_allocator::free(uint32_t offset, uint32_t size){
+	if( size == 0 ){
+		return;
+	}
+	allocated -= size;
+
+	// Merge with the free range just after, then with the one just before
+	std::map<uint32_t, uint32_t>::iterator next = free_ranges.find(offset + size);
+	if( next != free_ranges.end() ){
+		size += next->second;
+		free_ranges.erase(next);
+	}
+	std::map<uint32_t, uint32_t>::iterator range = free_ranges.insert(std::make_pair(offset, size)).first;
+	if( range != free_ranges.begin() ){
+		std::map<uint32_t, uint32_t>::iterator previous = range;
+		--previous;
+		if( previous->first + previous->second == offset ){
+			previous->second += size;
+			free_ranges.erase(range);
+		}
+	}
+}
+
+void range_allocator::grow(uint32_t capacity){
+	if( capacity <= total ){
+		return;
+	}
+	// The new room is a free range, merged with a free range at the old end
+	uint32_t added = capacity - total;
+	uint32_t offset = total;
+	total = capacity;
+	allocated += added;
+	free(offset, added);
+}
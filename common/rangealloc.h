@@ -0,0 +1,32 @@
+#ifndef RANGEALLOC_H
+#define RANGEALLOC_H
+
+#include <map>
+#include <stdint.h>
+
+// Hands out ranges of a fixed-size space, such as the vertices or indices of a shared buffer. Ranges are taken from
+// the first free range large enough, and freed ranges merge with their free neighbours. Units are up to the caller.
+class range_allocator {
+public:
+	explicit range_allocator(uint32_t capacity = 0);
+
+	// Takes size units and sets offset to the first of them. Fails when no free range is large enough,
+	// in which case the caller can grow() the space and try again.
+	bool allocate(uint32_t size, uint32_t& offset);
+
+	// Returns a range given by allocate()
+	void free(uint32_t offset, uint32_t size);
+
+	// Adds room at the end of the space. Capacities smaller than the current one are ignored.
+	void grow(uint32_t capacity);
+
+	uint32_t capacity() const { return total; }
+	uint32_t used() const { return allocated; }
+
+private:
+	std::map<uint32_t, uint32_t> free_ranges;	// Size of each free range by its offset
+	uint32_t total;
+	uint32_t allocated;
+};
+
+#endif
@@ -0,0 +1,47 @@
+#include <string.h>
+
+#include "scenefile.h"
+
+const scene_file_header* check_scene_file(const void* data, size_t size){
+	if (!data || size < sizeof(scene_file_header)){
+		return nullptr;
+	}
+
+	const scene_file_header* header = (const scene_file_header*)data;
+	if (memcmp(header->magic, SceneFileMagic, sizeof(SceneFileMagic)) != 0 || header->version != SceneFileVersion){
+		return nullptr;
+	}
+
+	// Every table must fit in the file (computed in 64 bits so the checks cannot overflow)
+	uint64_t objects_end = (uint64_t)header->object_offset + (uint64_t)header->object_count * sizeof(scene_file_object);
+	uint64_t strings_end = (uint64_t)header->string_offset + (uint64_t)header->string_count * sizeof(scene_file_string);
+	uint64_t data_end = (uint64_t)header->string_data_offset + header->string_data_size;
+	if (objects_end > size || strings_end > size || data_end > size || header->object_offset % 4 != 0 || header->string_offset % 4 != 0){
+		return nullptr;
+	}
+
+	const scene_file_string* strings = (const scene_file_string*)((const char*)data + header->string_offset);
+	for (uint32_t i = 0; i < header->string_count; i++){
+		if ((uint64_t)strings[i].offset + strings[i].length > header->string_data_size){
+			return nullptr;
+		}
+	}
+
+	// Objects may only refer to strings in the table
+	const scene_file_object* objects = scene_file_objects(header);
+	for (uint32_t i = 0; i < header->object_count; i++){
+		if (objects[i].shape >= header->string_count || objects[i].color >= header->string_count){
+			return nullptr;
+		}
+	}
+	if (header->background >= header->string_count){
+		return nullptr;
+	}
+	return header;
+}
+
+std::string scene_file_string_at(const scene_file_header* header, uint32_t index){
+	const scene_file_string* strings = (const scene_file_string*)((const char*)header + header->string_offset);
+	const char* string_data = (const char*)header + header->string_data_offset;
+	return std::string(string_data + strings[index].offset, strings[index].length);
+}
@@ -0,0 +1,58 @@
+#ifndef SCENEFILE_H
+#define SCENEFILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+// Binary scene file, laid out so it can be used straight from a memory mapping:
+//
+//   scene_file_header
+//   scene_file_object[object_count]     at object_offset
+//   scene_file_string[string_count]     at string_offset
+//   string data (not null terminated)   at string_data_offset, string_data_size bytes
+//
+// Shapes, colors and the background are stored as indices into the string table, so names
+// are looked up once per file rather than once per object. All values are little endian.
+
+static const char SceneFileMagic[4] = {'O', 'C', 'S', 'N'};
+static const uint32_t SceneFileVersion = 1;
+
+struct scene_file_header {
+	char magic[4];
+	uint32_t version;
+	uint32_t object_count;
+	uint32_t object_offset;
+	uint32_t string_count;
+	uint32_t string_offset;
+	uint32_t string_data_offset;
+	uint32_t string_data_size;
+	uint32_t background;			// String index of the background color
+	uint32_t reserved;
+	uint64_t journal_sequence;		// Last journaled batch included in the file
+};
+
+struct scene_file_object {
+	float position[3];
+	float scale[3];
+	float angle;
+	uint32_t shape;					// String index of the shape name
+	uint32_t color;					// String index of the color name
+};
+
+struct scene_file_string {
+	uint32_t offset;				// From string_data_offset
+	uint32_t length;
+};
+
+// Returns the header if data holds a scene file of a supported version whose tables all lie inside it
+const scene_file_header* check_scene_file(const void* data, size_t size);
+
+inline const scene_file_object* scene_file_objects(const scene_file_header* header){
+	return (const scene_file_object*)((const char*)header + header->object_offset);
+}
+
+// String index of a (checked) scene file
+std::string scene_file_string_at(const scene_file_header* header, uint32_t index);
+
+#endif
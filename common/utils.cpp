@@ -139,13 +139,18 @@ GLFWwindow* CreateWindow(const char *name) {
         return window;
     }
 
-	// Try to make OpenGL 4.1 core context
+	// Try to make OpenGL 4.3 core context (compute shaders and indirect draws), then 4.1
     glfwWindowHint( GLFW_CONTEXT_VERSION_MAJOR, 4 );
-    glfwWindowHint( GLFW_CONTEXT_VERSION_MINOR, 1 );
+    glfwWindowHint( GLFW_CONTEXT_VERSION_MINOR, 3 );
     glfwWindowHint( GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE );
     glfwWindowHint( GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE );
     window = glfwCreateWindow( 640, 480, name, NULL, NULL );
 
+    if ( !window ) {
+        glfwWindowHint( GLFW_CONTEXT_VERSION_MINOR, 1 );
+        window = glfwCreateWindow( 640, 480, name, NULL, NULL );
+    }
+
 	// Try to make any OpenGL core context
     if ( !window ) {
 		glfwDefaultWindowHints();
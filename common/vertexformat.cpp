@@ -0,0 +1,145 @@
+#include <math.h>
+#include <string.h>
+
+#include "vertexformat.h"
+
+static const uint32_t AttributeSize[MeshNumAttributes] = {4 * sizeof(uint16_t), 2 * sizeof(int16_t), 2 * sizeof(uint16_t)};
+
+vertex_layout make_vertex_layout(uint32_t attributes){
+	vertex_layout layout;
+	memset(&layout, 0, sizeof(layout));
+	layout.attributes = attributes;
+	for( int a = 0; a < MeshNumAttributes; a++ ){
+		if( attributes & (1u << a) ){
+			layout.offsets[a] = layout.stride;
+			layout.stride += AttributeSize[a];
+		}
+	}
+	return layout;
+}
+
+position_quantization quantize_bounds(const float * bounds_min, const float * bounds_max){
+	position_quantization q;
+	for( int c = 0; c < 3; c++ ){
+		q.offset[c] = bounds_min[c];
+		q.scale[c] = bounds_max[c] > bounds_min[c] ? bounds_max[c] - bounds_min[c] : 0.0f;
+	}
+	return q;
+}
+
+static inline float clamp01(float f){
+	return f < 0.0f ? 0.0f : (f > 1.0f ? 1.0f : f);
+}
+
+static inline int16_t snorm16(float f){
+	f = f < -1.0f ? -1.0f : (f > 1.0f ? 1.0f : f);
+	return (int16_t)lrintf(f * 32767.0f);
+}
+
+void pack_vertices(const mesh_cache & mesh, const vertex_layout & layout, std::vector<uint8_t> & out){
+	uint32_t count = mesh.vertex_count();
+	out.assign((size_t)count * layout.stride, 0);
+
+	const float * positions = (const float *)mesh.data(MeshPosition);
+	const float * normals = mesh.components(MeshNormal) == 3 ? (const float *)mesh.data(MeshNormal) : NULL;
+	const float * uvs = mesh.components(MeshTexCoord) == 2 ? (const float *)mesh.data(MeshTexCoord) : NULL;
+	position_quantization q = quantize_bounds(mesh.bounds_min(), mesh.bounds_max());
+
+	for( uint32_t i = 0; i < count; i++ ){
+		uint8_t * vertex = &out[(size_t)i * layout.stride];
+
+		if( layout.attributes & VertexPosition ){
+			uint16_t p[4] = {0, 0, 0, 0};
+			for( int c = 0; c < 3; c++ ){
+				float t = q.scale[c] > 0.0f ? (positions[i * 4 + c] - q.offset[c]) / q.scale[c] : 0.0f;
+				p[c] = (uint16_t)lrintf(clamp01(t) * 65535.0f);
+			}
+			memcpy(vertex + layout.offsets[MeshPosition], p, sizeof(p));
+		}
+
+		if( layout.attributes & VertexNormal ){
+			int16_t n[2] = {0, 0};
+			if( normals ){
+				encode_octahedral(&normals[i * 3], n);
+			}
+			memcpy(vertex + layout.offsets[MeshNormal], n, sizeof(n));
+		}
+
+		if( layout.attributes & VertexTexCoord ){
+			uint16_t t[2] = {0, 0};
+			if( uvs ){
+				t[0] = float_to_half(uvs[i * 2]);
+				t[1] = float_to_half(uvs[i * 2 + 1]);
+			}
+			memcpy(vertex + layout.offsets[MeshTexCoord], t, sizeof(t));
+		}
+	}
+}
+
+uint16_t float_to_half(float f){
+	uint32_t bits;
+	memcpy(&bits, &f, sizeof(bits));
+
+	uint32_t sign = (bits >> 16) & 0x8000;
+	int32_t exponent = (int32_t)((bits >> 23) & 0xff) - 127 + 15;
+	uint32_t mantissa = bits & 0x7fffff;
+
+	// Infinity and NaN (kept a NaN by setting a mantissa bit)
+	if( ((bits >> 23) & 0xff) == 0xff ){
+		return (uint16_t)(sign | 0x7c00 | (mantissa ? 0x200 : 0));
+	}
+	// Too large for a half, round to infinity
+	if( exponent >= 31 ){
+		return (uint16_t)(sign | 0x7c00);
+	}
+	// Denormal half (or zero), shift in the implicit bit and round to nearest even
+	if( exponent <= 0 ){
+		if( exponent < -10 ){
+			return (uint16_t)sign;
+		}
+		mantissa |= 0x800000;
+		uint32_t shift = (uint32_t)(14 - exponent);
+		uint32_t half = mantissa >> shift;
+		uint32_t rest = mantissa & ((1u << shift) - 1);
+		uint32_t halfway = 1u << (shift - 1);
+		if( rest > halfway || (rest == halfway && (half & 1)) ){
+			half++;
+		}
+		return (uint16_t)(sign | half);
+	}
+
+	// Normal half, round to nearest even (a carry into the exponent is still correct, up to infinity)
+	uint32_t half = ((uint32_t)exponent << 10) | (mantissa >> 13);
+	uint32_t rest = mantissa & 0x1fff;
+	if( rest > 0x1000 || (rest == 0x1000 && (half & 1)) ){
+		half++;
+	}
+	return (uint16_t)(sign | half);
+}
+
+void encode_octahedral(const float * normal, int16_t * out){
+	// Project onto the octahedron |x| + |y| + |z| = 1, then fold the lower half over the diagonals
+	float length = fabsf(normal[0]) + fabsf(normal[1]) + fabsf(normal[2]);
+	if( length <= 0.0f ){
+		out[0] = out[1] = 0;
+		return;
+	}
+
+	float x = normal[0] / length;
+	float y = normal[1] / length;
+	if( normal[2] < 0.0f ){
+		float folded_x = (1.0f - fabsf(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+		float folded_y = (1.0f - fabsf(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+		x = folded_x;
+		y = folded_y;
+	}
+	out[0] = snorm16(x);
+	out[1] = snorm16(y);
+}
+
+uint32_t pack_rgba8(float r, float g, float b, float a){
+	return (uint32_t)lrintf(clamp01(r) * 255.0f) |
+		((uint32_t)lrintf(clamp01(g) * 255.0f) << 8) |
+		((uint32_t)lrintf(clamp01(b) * 255.0f) << 16) |
+		((uint32_t)lrintf(clamp01(a) * 255.0f) << 24);
+}
@@ -0,0 +1,52 @@
+#ifndef VERTEXFORMAT_H
+#define VERTEXFORMAT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include "meshcache.h"
+
+// Interleaved, quantized vertex layout for model buffers. Each attribute present takes:
+//
+//   position    4 x uint16, normalized   position within the mesh bounds (the 4th is padding)
+//   normal      2 x int16, normalized    octahedral encoding of the unit normal
+//   texcoord    2 x half float
+//
+// against 16, 12 and 8 bytes as floats. Positions are dequantized in the vertex shader with
+// the mesh's position_quantization: position = offset + scale * stored.
+
+enum vertex_attribute_bits {
+	VertexPosition = 1 << MeshPosition,
+	VertexNormal = 1 << MeshNormal,
+	VertexTexCoord = 1 << MeshTexCoord
+};
+
+struct vertex_layout {
+	uint32_t attributes;					// vertex_attribute_bits present
+	uint32_t stride;						// Bytes per vertex
+	uint32_t offsets[MeshNumAttributes];	// Byte offset of each attribute present
+};
+
+// Layout holding the given attributes, in mesh_attribute order
+vertex_layout make_vertex_layout(uint32_t attributes);
+
+struct position_quantization {
+	float offset[3];
+	float scale[3];
+};
+
+position_quantization quantize_bounds(const float * bounds_min, const float * bounds_max);
+
+// Converts the vertices of a mesh to the layout
+void pack_vertices(const mesh_cache & mesh, const vertex_layout & layout, std::vector<uint8_t> & out);
+
+uint16_t float_to_half(float f);
+
+// Octahedral encoding of a unit vector into two signed normalized values
+void encode_octahedral(const float * normal, int16_t * out);
+
+// Color with components in [0, 1] as RGBA8 (red in the lowest byte)
+uint32_t pack_rgba8(float r, float g, float b, float a);
+
+#endif
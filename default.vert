@@ -1,15 +1,25 @@
 #version 400 core
-uniform mat4 proj_matrix;
-uniform mat4 camera_matrix;
-uniform mat4 model_matrix;
+layout(std140) uniform FrameData {
+    mat4 view_matrix;
+    mat4 proj_matrix;
+    mat4 view_proj_matrix;
+    vec4 viewport;      // width, height, 1/width, 1/height
+};
+
+// Model positions are 16-bit normalized within the mesh bounds: position = mesh_offset + mesh_scale * stored
+uniform vec3 mesh_offset;
+uniform vec3 mesh_scale;
 
 layout(location = 0) in vec4 vPosition;
 layout(location = 1) in vec4 vColor;
+layout(location = 2) in vec4 vModel[3];   // Rows of the affine model transform
 
 out vec4 oColor;
 
 void main()
 {
-    gl_Position = proj_matrix*camera_matrix*model_matrix*vPosition;
+    vec4 position = vec4(mesh_offset + mesh_scale * vPosition.xyz, 1.0);
+    vec4 worldPosition = vec4(dot(vModel[0], position), dot(vModel[1], position), dot(vModel[2], position), 1.0);
+    gl_Position = view_proj_matrix*worldPosition;
     oColor = vColor;
 }
@@ -0,0 +1,44 @@
+#version 430 core
+layout(std140) uniform FrameData {
+    mat4 view_matrix;
+    mat4 proj_matrix;
+    mat4 view_proj_matrix;
+    vec4 viewport;      // width, height, 1/width, 1/height
+};
+
+struct object_transform {
+    vec4 model[3];      // Rows of the affine model transform
+    vec4 center;
+    vec4 extents;
+};
+
+// Model positions are 16-bit normalized within the mesh bounds: position = offset + scale * stored
+struct mesh_entry {
+    uint lod_count;
+    uint first_command;
+    uint pad0;
+    uint pad1;
+    vec4 errors[2];
+    vec4 offset;
+    vec4 scale;
+};
+
+layout(std430, binding = 0) readonly buffer ObjectTransforms { object_transform transforms[]; };
+layout(std430, binding = 1) readonly buffer ObjectInfo { uvec2 infos[]; };     // Mesh and palette index
+layout(std430, binding = 2) readonly buffer Palette { vec4 palette[]; };
+layout(std430, binding = 3) readonly buffer MeshTable { mesh_entry meshes[]; };
+
+layout(location = 0) in vec4 vPosition;
+layout(location = 1) in uint vObject;     // Per instance, from the visible list written by cull.comp
+
+out vec4 oColor;
+
+void main()
+{
+    object_transform t = transforms[vObject];
+    uvec2 info = infos[vObject];
+    vec4 position = vec4(meshes[info.x].offset.xyz + meshes[info.x].scale.xyz * vPosition.xyz, 1.0);
+    vec4 worldPosition = vec4(dot(t.model[0], position), dot(t.model[1], position), dot(t.model[2], position), 1.0);
+    gl_Position = view_proj_matrix*worldPosition;
+    oColor = palette[info.y];
+}
@@ -9,6 +9,16 @@
 #include "./common/objloader.h"
 #include "./common/utils.h"
 #include "./common/vmath.h"
+#include "./common/glstate.h"
+#include "./common/bvh.h"
+#include "./common/mpscqueue.h"
+#include "./common/journal.h"
+#include "./common/mappedfile.h"
+#include "./common/scenefile.h"
+#include "./common/meshcache.h"
+#include "./common/vertexformat.h"
+#include "./common/primitives.h"
+#include "./common/rangealloc.h"
 #include <iostream>
 #include <thread>
 #include <atomic>
@@ -16,36 +26,20 @@
 #include <iosfwd>
 #include <fstream>
 #include <unordered_map>
-#include <stack>
+#include <deque>
+#include <unordered_set>
 #include <sstream>
+#include <cstring>
+#include <memory>
 
 using namespace vmath;
 using namespace std;
 
-// Vertex array and buffer names
-enum VAO_IDs {Cube, Cone, Torus, Cylinder, Sphere, Axes, NumVAOs};
-enum ObjBuffer_IDs {PosBuffer, NormBuffer, TexBuffer, NumObjBuffers};
-enum Color_Buffer_IDs {
-    RedCube, RedCone, RedTorus, RedCylinder, RedSphere,
-    GreenCube, GreenCone, GreenTorus, GreenCylinder, GreenSphere,
-    BlueCube, BlueCone, BlueTorus, BlueCylinder, BlueSphere,
-    YellowCube, YellowCone, YellowTorus, YellowCylinder, YellowSphere,
-    CyanCube, CyanCone, CyanTorus, CyanCylinder, CyanSphere,
-    MagentaCube, MagentaCone, MagentaTorus, MagentaCylinder, MagentaSphere,
-    BlackCube, BlackCone, BlackTorus, BlackCylinder, BlackSphere,
-    OrangeCube, OrangeCone, OrangeTorus, OrangeCylinder, OrangeSphere,
-    PurpleCube, PurpleCone, PurpleTorus, PurpleCylinder, PurpleSphere,
-    GrayCube, GrayCone, GrayTorus, GrayCylinder, GraySphere,
-    AxesColor, NumColorBuffers
-};
-
-// Vertex array and buffer objects
-GLuint VAOs[NumVAOs];
-GLuint ObjBuffers[NumVAOs][NumObjBuffers];
-GLuint ColorBuffers[NumColorBuffers];
+// Buffers shared by every mesh: vertices, indices, and the instances drawn this frame
+enum SharedBuffer_IDs {VertexBuffer, IndexBuffer, InstBuffer, NumSharedBuffers};
 
-// Number of vertices in each object
-GLint numVertices[NumVAOs];
+// Packed vertex layout of the mesh buffers (only the attributes the shader reads)
+vertex_layout modelLayout;
 
 // Number of component coordinates
 GLint posCoords = 4;
@@ -55,16 +49,15 @@ GLint colCoords = 4;
 
 GLfloat axis_length = 3.0f;
 
-// Model files
-const char * cubeFile = "../models/unitcube.obj";
-const char * coneFile = "../models/cone.obj";
-const char * cylinderFile = "../models/cylinder.obj";
-const char * torusFile = "../models/torus.obj";
-const char * sphereFile = "../models/sphere.obj";
-
 // Texture files
 const char * blankFile = "../textures/blank.png";
 
+// Save files: the binary scene snapshot and the journal of changes made since it was written. Scenes saved before
+// the binary format are read once from the text save file, which import and export also use.
+const char * saveFile = "save.bin";
+const char * journalFile = "save.journal";
+const char * textSaveFile = "save.txt";
+
 // Camera
 vec3 eye = {3.0f, 0.0f, 0.0f};
 vec3 center = {0.0f, 0.0f, 0.0f};
@@ -83,19 +76,55 @@ GLfloat max_radius = 6.0f;
 GLuint default_program;
 GLuint default_vPos;
 GLuint default_vCol;
-GLuint default_proj_mat_loc;
-GLuint default_cam_mat_loc;
-GLuint default_model_mat_loc;
+GLuint default_vModel;
+GLint default_vNormal;          // -1 when the shader does not read the attribute
+GLint default_vTexCoord;
+GLint default_mesh_offset;
+GLint default_mesh_scale;
+GLuint default_frame_block;
 const char *default_vertex_shader = "../default.vert";
 const char *default_frag_shader = "../default.frag";
 
+// GPU culling shader programs (see render_scene_gpu)
+GLuint cull_program;
+GLint cull_object_count;
+GLint cull_planes;
+GLint cull_pixels_per_unit;
+GLint cull_lod_error;
+GLint cull_lod_hysteresis;
+GLint cull_phase;
+GLint cull_phase_commands;
+GLint cull_occlusion;
+GLint cull_depth_pyramid;
+const char *cull_compute_shader = "../cull.comp";
+GLuint pyramid_program;
+GLint pyramid_source;
+GLint pyramid_source_level;
+GLint pyramid_destination;
+const char *depth_pyramid_shader = "../depthpyramid.comp";
+GLuint indirect_program;
+GLint indirect_vPos;
+GLint indirect_vObject;
+const char *indirect_vertex_shader = "../indirect.vert";
+
 // Global state
 mat4 proj_matrix;
 mat4 camera_matrix;
 mat4 normal_matrix;
-mat4 model_matrix;
 
-// The list of possible colors a user can use is not dynamic in this program, and are thus predefined here.
+// Per-frame data shared by every draw, laid out to match the std140 FrameData block in default.vert
+struct frame_data {
+    mat4 view;
+    mat4 proj;
+    mat4 view_proj;
+    vec4 viewport;      // width, height, 1/width, 1/height
+};
+
+// Uniform buffer holding frame_data and the binding point it is attached to
+GLuint FrameUBO;
+const GLuint FrameDataBinding = 0;
+
+// Named colors that are always available. Any other color can be given in hex (e.g., #ff8800 or #ff880080).
 // These are a few colors that came to mind first.
 vector<pair<string, vector<float>>> colorMap = {
     {"red", {1.0f, 0.0f, 0.0f}},
@@ -113,27 +142,325 @@ vector<pair<string, vector<float>>> colorMap = {
 // Flag to track whether or not the user types in "quit".
 atomic<bool> quitFlag(false);
 
+// Set when the scene, camera or window changed and a new frame must be drawn.
+atomic<bool> frameDirty(true);
+
+// Redraw every iteration instead of only on changes (--continuous), and the frame rate cap (--fps, 0 = none)
+bool continuous_mode = false;
+double max_fps = 0.0;
+
+// Largest geometric error of a level of detail allowed on screen, in pixels (--lod-error, 0 draws full detail).
+// Switching to a coarser level needs its error under LodHysteresis times that, so objects near a switch point
+// do not pop back and forth.
+float lod_pixel_error = 1.0f;
+const float LodHysteresis = 0.75f;
+
 // Background color
 string background_color = "gray";
 
-// Color library for shapes
+// Color palette (RGBA) shared by all objects, the name of each palette entry and the palette index of each color name
+vector<vec4> ColorPalette;
+vector<string> ColorNames;
 unordered_map<string, GLuint> ColorLibrary;
 
-// Cube struct to keep attributes for objects ordered.
-struct object {
-    string shape_type;
+// All fields of a single object, used where one object is copied in or out of the scene as a whole
+struct object_record {
     vec3 position;
     vec3 scale;
     float angle;
-    string color;
-    object(string shape, vec3 pos, vec3 scale, float ang, string col = "") : shape_type(shape), position(pos), scale(scale), angle(ang), color(col) {}
+    GLuint shape;
+    GLuint color;
+};
+
+// Scene objects kept as parallel arrays (one entry per object in each). Shapes and colors are stored as
+// ids, names are only looked up when parsing commands and reading or writing save data.
+struct object_store {
+    vector<vec3> positions;
+    vector<vec3> scales;
+    vector<float> angles;
+    vector<GLuint> shapes;      // Index into meshes
+    vector<GLuint> colors;      // Index into ColorPalette
+    vector<GLuint> revisions;   // Stamp that changes whenever the object's position, angle or scale changes
+    GLuint next_revision = 1;
+    GLuint structure_version = 0;   // Changes whenever objects are added or removed (indices changed)
+
+    size_t size() const { return positions.size(); }
+    bool empty() const { return positions.empty(); }
+
+    void add(GLuint shape, const vec3& pos, const vec3& scl, float ang, GLuint color) {
+        positions.push_back(pos);
+        scales.push_back(scl);
+        angles.push_back(ang);
+        shapes.push_back(shape);
+        colors.push_back(color);
+        revisions.push_back(next_revision++);
+        structure_version++;
+    }
+
+    void insert(size_t index, const object_record& object) {
+        positions.insert(positions.begin() + index, object.position);
+        scales.insert(scales.begin() + index, object.scale);
+        angles.insert(angles.begin() + index, object.angle);
+        shapes.insert(shapes.begin() + index, object.shape);
+        colors.insert(colors.begin() + index, object.color);
+        revisions.insert(revisions.begin() + index, next_revision++);
+        structure_version++;
+    }
+
+    object_record get(size_t index) const {
+        object_record object;
+        object.position = positions[index];
+        object.scale = scales[index];
+        object.angle = angles[index];
+        object.shape = shapes[index];
+        object.color = colors[index];
+        return object;
+    }
+
+    void set(size_t index, const object_record& object) {
+        positions[index] = object.position;
+        scales[index] = object.scale;
+        angles[index] = object.angle;
+        shapes[index] = object.shape;
+        colors[index] = object.color;
+        mark_dirty(index);
+    }
+
+    // Flags an object whose position, angle or scale changed.
+    void mark_dirty(size_t index) {
+        revisions[index] = next_revision++;
+    }
+
+    void erase(size_t index) {
+        positions.erase(positions.begin() + index);
+        scales.erase(scales.begin() + index);
+        angles.erase(angles.begin() + index);
+        shapes.erase(shapes.begin() + index);
+        colors.erase(colors.begin() + index);
+        revisions.erase(revisions.begin() + index);
+        structure_version++;
+    }
+
+    void clear() {
+        positions.clear();
+        scales.clear();
+        angles.clear();
+        shapes.clear();
+        colors.clear();
+        revisions.clear();
+        structure_version++;
+    }
+};
+
+// All objects in the scene. Queued commands change it between frames, so the renderer reads it directly.
+object_store objects;
+
+// Set when a batch of commands changed the scene; the next frame brings the render cache up to date.
+bool scene_changed = true;
+
+// Renderer state derived from the scene. An object's model matrix and bounds are rebuilt
+// when its revision differs from the one they were built from.
+struct render_cache {
+    vector<affine> models;
+    vector<aabb> bounds;
+    vector<GLuint> revisions;
+    vector<GLubyte> lods;           // Level of detail each object was last drawn with
+    GLuint structure_version = ~0u;
+    bool objects_changed = false;   // Set on every update, cleared once the GPU culling buffers have caught up
+    bool structure_changed = false;
+};
+render_cache scene_cache;
+
+// Hierarchy over the object bounds used for view frustum culling
+bvh scene_bvh;
+vector<GLuint> changed_objects;         // Objects whose bounds changed this frame
+vector<GLuint> visible_objects;         // Objects inside the view frustum this frame
+size_t refits_since_build = 0;          // Refitted objects since the last full rebuild
+
+// Culling results of the last frame, written by the renderer and read by the 'stats' command
+atomic<size_t> stats_objects_drawn(0);
+atomic<size_t> stats_objects_total(0);
+atomic<size_t> stats_bvh_nodes(0);
+atomic<size_t> stats_triangles_drawn(0);
+atomic<size_t> stats_triangles_total(0);       // Of every object at full detail
+atomic<size_t> stats_lod_objects[MeshMaxLods];  // Objects drawn at each level of detail
+atomic<size_t> stats_objects_occluded(0);       // Inside the view volume but hidden behind other objects
+
+// A mesh generated by a loader thread, waiting for the main thread to upload it
+struct loaded_model {
+    GLuint mesh_id;                 // Index into meshes
+    unique_ptr<mesh_cache> mesh;    // Null if the mesh could not be built
+    vector<uint8_t> vertices;       // Vertices packed in modelLayout
+    double load_ms;                 // Time spent generating on the worker
+};
+
+// Meshes are generated on worker threads the first time an object uses them, so neither startup nor adding an object
+// with a new tessellation waits for them. Each finished mesh is queued for the main loop, which uploads it; until
+// then it has no vertices and its objects are not drawn. A loader is joined once its mesh has been uploaded.
+unordered_map<GLuint, thread> model_loaders;       // Running loaders by mesh id
+mpsc_queue<loaded_model> loaded_models;
+vector<loaded_model> loaded_batch;
+int models_pending = 0;
+bool render_cache_stale = false;        // Object bounds must be rebuilt although the scene did not change
+
+// Startup timings in ms since GLFW was initialized (0 until reached). models_loaded_ms is when the meshes of the
+// scene restored at startup were all uploaded.
+double first_frame_ms = 0.0;
+double models_loaded_ms = 0.0;
+GLuint startup_meshes = 0;              // Meshes created before the main loop started
+int startup_models_pending = 0;         // Of those, the ones not uploaded yet
+
+// Per-instance attributes uploaded to a shape's instance buffer. The color is RGBA8.
+struct instance {
+    affine model;
+    GLuint color;
+    instance(const affine& m, const vec4& col) : model(m), color(pack_rgba8(col[0], col[1], col[2], col[3])) {}
+};
+
+// A mesh objects are drawn with: one built-in shape at one tessellation, shared by every object using the same key
+struct model_mesh {
+    GLuint base_vertex = 0;             // First vertex in the shared vertex buffer
+    GLuint first_index = 0;             // First index in the shared index buffer (level offsets are relative to it)
+    GLint num_vertices = 0;             // 0 while the mesh is being generated
+    GLint num_indices = 0;              // Of all levels, 0 if not indexed
+    vector<mesh_file_lod> lods;         // Levels of detail, the full mesh first
+    aabb bounds;                        // Object space bounds
+    float radius = 0.0f;                // Half the bounds diagonal, the size level of detail errors are relative to
+    position_quantization quantization; // Dequantization of the packed positions
+    mesh_file_stats stats;              // Indexing statistics, for the 'stats' command
+    vector<instance> instances[MeshMaxLods];    // Instances drawn this frame at each level of detail
+    GLuint first_instance[MeshMaxLods] = {};    // Where they start in the shared instance buffer
+};
+
+// Meshes by id, the key of each mesh (see primitives.h) and the id of each key. Meshes are never removed, so ids
+// stay valid in the undo history.
+vector<model_mesh> meshes;
+vector<string> MeshNames;
+unordered_map<string, GLuint> MeshLibrary;
+
+model_mesh axes_mesh;
+
+// Every mesh, the axes included, is suballocated from the shared vertex and index buffers, which grow (keeping their
+// names) when full. The instances of every batch are streamed into the shared instance buffer once per frame. All
+// meshes are drawn from one vertex array per program, so switching meshes only changes the offsets of a draw.
+GLuint SharedBuffers[NumSharedBuffers];
+GLuint model_vao;                       // Default program: packed vertices and per-instance attributes
+bool base_instance_draws = false;       // GL 4.2 or ARB_base_instance: draws start at their batch's instances
+GLuint indirect_vao;                    // GPU culling path: packed positions and the visible object list
+range_allocator vertex_arena;           // In vertices of modelLayout
+range_allocator index_arena;            // In indices
+const GLuint InitialArenaVertices = 1 << 16;
+const GLuint InitialArenaIndices = 1 << 18;
+vector<instance> frame_instances;       // Contents of the shared instance buffer, the axes first
+
+// GPU-driven rendering (GL 4.3, turned off with --cpu-culling). The objects live in shader storage buffers, only
+// updated where the scene changed, and a compute shader culls them against the view frustum, picks their level of
+// detail and appends them to the instance list of their mesh and level. Each mesh is then drawn with one
+// glMultiDrawElementsIndirect call over its levels, so the CPU work per frame depends on the number of meshes rather
+// than objects. The buffer IDs are also the storage buffer binding points used by the shaders.
+enum GpuBuffer_IDs {TransformBuffer, ObjectInfoBuffer, PaletteBuffer, MeshTableBuffer, LodStateBuffer, CommandBuffer,
+                    VisibleBuffer, VisibilityBuffer, OcclusionStatsBuffer, NumGpuBuffers};
+GLuint GpuBuffers[NumGpuBuffers];
+bool gpu_culling = false;
+bool gpu_culling_disabled = false;
+
+// Occlusion culling on the GPU path (turned off with --no-occlusion). The objects visible last frame are drawn
+// first, the depth they leave is reduced into a pyramid of farthest depths, and every other object is drawn only if
+// its bounds are in front of the pyramid somewhere (see cull.comp). Each set of objects has its own draw commands.
+enum CullPhase {CullVisibleLastFrame, CullRemaining, NumCullPhases};
+bool occlusion_culling = false;
+bool occlusion_culling_disabled = false;
+GLuint depth_texture;                   // Copy of the window's depth after the first phase
+GLuint depth_pyramid;
+GLint depth_width = 0;                  // Window size the textures were made for
+GLint depth_height = 0;
+GLint pyramid_width = 0;                // Of level 0
+GLint pyramid_height = 0;
+GLint pyramid_levels = 0;
+
+// Storage buffer layouts (std430), matching cull.comp and indirect.vert
+struct gpu_transform {
+    affine model;
+    vec4 center;        // World bounds center, w = mesh radius times the object's largest scale factor
+    vec4 extents;       // World bounds half size
+};
+
+struct gpu_mesh {
+    GLuint lod_count;   // 0 while the mesh is being generated
+    GLuint first_command;
+    GLuint pad[2];
+    GLfloat errors[8];  // Error of each level relative to the mesh radius
+    GLfloat offset[4];  // Position dequantization (see position_quantization)
+    GLfloat scale[4];
+};
+
+// DrawElementsIndirectCommand
+struct draw_elements_command {
+    GLuint count;
+    GLuint instance_count;
+    GLuint first_index;
+    GLint base_vertex;
+    GLuint base_instance;
+};
+
+// CPU copies of the object buffers, the objects using each mesh and room in the visible list (in objects)
+vector<gpu_transform> gpu_transforms;
+vector<GLuint> gpu_object_info;         // Mesh and palette index of each object
+vector<GLuint> gpu_mesh_objects;
+vector<gpu_mesh> gpu_mesh_table;
+vector<draw_elements_command> gpu_commands;
+size_t gpu_object_capacity = 0;
+size_t gpu_visible_capacity = 0;
+size_t gpu_phase_commands = 0;          // Commands of each phase, a block of MeshMaxLods per mesh
+GLuint gpu_structure_version = ~0u;
+
+// One change to the scene in the undo history. Applying it performs the change and yields the change that reverts it.
+enum history_change_kind {HistInsert, HistErase, HistSet};
+struct history_change {
+    GLubyte kind;           // history_change_kind
+    GLuint index;           // Object index
+    object_record object;   // Object to insert or values to set
+};
+
+// One undo step: every change made by a batch of commands. While the step can be undone, its changes revert the
+// batch (applied last to first); undoing it turns them into the changes that redo the batch, and back again.
+struct history_step {
+    vector<history_change> changes;
+    bool has_background = false;
+    string background;      // Background color to swap in when applied
 };
 
-// Vector of objects
-vector<object> objects;
+// Undo history. Steps before history_cursor can be undone, the ones from it on redone.
+deque<history_step> history;
+size_t history_cursor = 0;
+size_t history_bytes = 0;               // Approximate memory held by all steps
+size_t history_limit = 64 << 20;        // Memory cap (--history-mb), reached by compacting or dropping old steps
+history_step pending_step;              // Changes recorded since the last checkpoint
+
+// Scene persistence. Every applied batch of changes is appended to the journal as one record ending in
+// "commit <sequence>"; the snapshot is rewritten (and the journal emptied) once the journal outgrows it.
+journal scene_journal;
+ostringstream journal_batch;            // Journal lines of the batch being applied
+unsigned long long journal_sequence = 0;        // Sequence number of the last committed batch
+size_t journal_bytes = 0;               // Journal written since the last snapshot
+const size_t JournalCompactBytes = 1 << 20;
+
+// Commands that change or query the scene. They are queued by the command listener (or a script) and applied by
+// the main loop between frames.
+enum scene_command_type {CmdAdd, CmdMove, CmdDelete, CmdRotate, CmdScale, CmdColor, CmdBackground, CmdClearCanvas,
+                         CmdLoad, CmdImport, CmdExport, CmdUndo, CmdRedo, CmdList, CmdStats};
+
+// A parsed command waiting to be applied
+struct scene_command {
+    GLubyte type = CmdList;     // scene_command_type
+    GLint index = -1;           // Object index
+    vec3 vector = vec3(0.0f, 0.0f, 0.0f);   // Position, movement or scale (the angle for rotate is in x)
+    string name;                // Shape name for add, color name or hex color for color and background, file name for import and export
+};
 
-// Keeps track of all changes in current run
-stack<string> state_stack;
+// Commands from all producers, drained once per frame, and the batch taken from it
+mpsc_queue<scene_command> command_queue;
+vector<scene_command> command_batch;
 
 // Global screen dimensions
 GLint ww,hh;
@@ -142,16 +469,47 @@ GLint ww,hh;
 void display();
 void render_scene();
 void build_geometry();
-void build_solid_color_buffer(GLuint num_vertices, vec4 color, GLuint buffer);
+void build_color_palette();
 void build_axes();
 void draw_axes();
-void load_model(const char * filename, GLuint obj);
-void draw_color_obj(GLuint obj, GLuint color);
+void build_shared_buffers();
+void build_model_buffers(model_mesh& mesh);
+GLuint allocate_shared(SharedBuffer_IDs buffer, range_allocator& arena, GLsizeiptr unit_size, GLuint count);
+GLuint register_mesh(const string& key);
+GLuint create_mesh(const string& key, primitive_shape shape, const primitive_parameters& parameters);
+GLuint create_file_mesh(const string& path);
+void load_model(GLuint mesh_id, primitive_shape shape, primitive_parameters parameters);
+void load_model_file(GLuint mesh_id, string path);
+void queue_loaded_model(GLuint mesh_id, unique_ptr<mesh_cache> mesh, double start_time);
+void upload_loaded_models();
+void report_models_loaded();
+void upload_model(const loaded_model& model);
+void upload_frame_instances();
+void draw_instanced_obj(model_mesh& mesh, GLuint level, GLenum mode);
+GLuint select_lod(const model_mesh& mesh, float pixel_radius, GLuint current);
+void set_instance_attributes();
+void point_instance_attributes(GLuint first_instance);
+void update_scene_bvh();
+bool build_gpu_culling();
+void update_gpu_objects();
+void render_scene_gpu();
+void draw_gpu_commands(GLuint phase);
+void build_depth_pyramid();
+void read_gpu_culling_stats();
+void update_render_cache(const object_store& scene_objects);
+void build_frame_buffer();
+void update_frame_data();
 void framebuffer_size_callback(GLFWwindow *window, int width, int height);
+void window_refresh_callback(GLFWwindow *window);
+void request_redraw();
 
 // Command functions
 void key_callback(GLFWwindow *window, int key, int scancode, int action, int mods);
 void commandListener();
+bool queue_command(const string& name, istream& in, bool interactive);
+void run_script(const string& filename);
+bool apply_command(const scene_command& cmd);
+void apply_pending_commands();
 void show_welcome_screen();
 void add_object(string shape, float x, float y, float z);
 void move_object(int index, float dx, float dy, float dz);
@@ -160,20 +518,57 @@ void rotate_object(int index, float ang);
 void scale_object(int index, vec3 scale_vector);
 void set_background_color();
 void save_state();
-void load_state();
-void save_change_to_stack();
-void load_change_from_stack(const string& state);
+size_t load_state();
+void write_scene(ostream& out, const object_store& store, const vector<string>& shape_names, const vector<string>& color_names,
+                 const string& background, unsigned long long sequence);
+bool read_snapshot(object_store& store, string& background, unsigned long long& sequence);
+void write_text_scene(ostream& out, const object_store& store, const vector<string>& shape_names, const vector<string>& color_names,
+                      const string& background);
+bool read_text_scene(istream& in, object_store& store, string& background, unsigned long long& sequence);
+void add_saved_scene(const object_store& store, const string& background);
+void import_scene(const string& filename);
+void export_scene(const string& filename);
+size_t replay_journal(object_store& store, string& background, unsigned long long& sequence);
+void apply_journal_batch(istream& in, object_store& store, string& background);
+void journal_object(const char* op, size_t index);
+void journal_erase(size_t index);
+void journal_clear();
+void journal_background();
+void commit_journal_batch();
+void record_insert(size_t index);
+void record_erase(size_t index);
+void record_modify(size_t index);
+void record_background();
+void commit_history_step();
+void apply_history_step(history_step& step);
+void compact_history_step(history_step& step);
+size_t history_step_bytes(const history_step& step);
+void trim_history();
 void undo_state();
+void redo_state();
 void clear_canvas();
 void assign_color_to_object(int index, const string& colorName);
 void print_help();
 void list_objects();
-void print_failed_command();
+void print_stats();
+void print_failed_command(istream& in);
+void parse_arguments(int argc, char**argv);
 string lower_string(string str);
 vector<float> get_color_rgb(string colorName);
-
-// Sets everything up, such as starting the thread for the commandListener and building geometry. Also holds the while loop that renders the scene continuously.
+int find_color(const string& colorName);
+bool is_model_file(const string& shapeName);
+int find_shape(const string& shapeName);
+void write_object(ostream& out, size_t index, const object_store& store, const vector<string>& shape_names,
+                  const vector<string>& color_names);
+bool read_object(istream& in, object_record& object);
+string normalize_color_name(string colorName);
+bool parse_hex_color(const string& hex, vec4& color);
+
+// Sets everything up, such as starting the thread for the commandListener and building geometry. Also holds the while loop
+// that renders the scene whenever it changes (or continuously with --continuous).
 int main(int argc, char**argv) {
+    parse_arguments(argc, argv);
+
 	// Create OpenGL window
 	GLFWwindow* window = CreateWindow("Think Inside The Box");
     if (!window) {
@@ -190,15 +585,31 @@ int main(int argc, char**argv) {
     // Register callbacks
     glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
     glfwSetKeyCallback(window,key_callback);
+    glfwSetWindowRefreshCallback(window, window_refresh_callback);
 
     // Load shaders and associate variables
     ShaderInfo default_shaders[] = { {GL_VERTEX_SHADER, default_vertex_shader},{GL_FRAGMENT_SHADER, default_frag_shader},{GL_NONE, NULL} };
     default_program = LoadShaders(default_shaders);
     default_vPos = glGetAttribLocation(default_program, "vPosition");
     default_vCol = glGetAttribLocation(default_program, "vColor");
-    default_proj_mat_loc = glGetUniformLocation(default_program, "proj_matrix");
-    default_cam_mat_loc = glGetUniformLocation(default_program, "camera_matrix");
-    default_model_mat_loc = glGetUniformLocation(default_program, "model_matrix");
+    default_vModel = glGetAttribLocation(default_program, "vModel");
+    default_vNormal = glGetAttribLocation(default_program, "vNormal");
+    default_vTexCoord = glGetAttribLocation(default_program, "vTexCoord");
+    default_mesh_offset = glGetUniformLocation(default_program, "mesh_offset");
+    default_mesh_scale = glGetUniformLocation(default_program, "mesh_scale");
+
+    // Model buffers hold only the attributes the shader reads
+    modelLayout = make_vertex_layout(VertexPosition | (default_vNormal >= 0 ? VertexNormal : 0) |
+                                     (default_vTexCoord >= 0 ? VertexTexCoord : 0));
+    default_frame_block = glGetUniformBlockIndex(default_program, "FrameData");
+    glUniformBlockBinding(default_program, default_frame_block, FrameDataBinding);
+
+    // Cull and draw on the GPU when the context allows it (GL 4.3), otherwise on the CPU
+    gpu_culling = !gpu_culling_disabled && build_gpu_culling();
+    printf("Culling on the %s\n", gpu_culling ? "GPU (compute shader and multi-draw indirect)" : "CPU");
+    if (gpu_culling) {
+        printf("Occlusion culling %s\n", occlusion_culling ? "on" : "off");
+    }
 
     // Create geometry buffers
     build_geometry();
@@ -213,10 +624,25 @@ int main(int argc, char**argv) {
 
     // Set background color
     glClearColor(0.4f, 0.4f, 0.4f, 1.0f);
-    load_state();
-    save_change_to_stack();
+    size_t journal_size = load_state();
+
+    // The loaded scene is where the undo history starts, and it is already saved
+    pending_step = history_step();
+    journal_batch.str("");
+
+    // Start journaling after the last complete batch, folding any journal left by the last run into a new snapshot
+    if (!scene_journal.open(journalFile, saveFile, (long)journal_size)) {
+        cerr << "Error opening journal file!" << endl;
+    }
     save_state();
 
+    // The restored scene is fully loaded once the meshes created so far are uploaded, right away if there are none
+    startup_meshes = (GLuint)meshes.size();
+    startup_models_pending = models_pending;
+    if (startup_models_pending == 0) {
+        report_models_loaded();
+    }
+
     // Set Initial camera position
     GLfloat x, y, z;
     x = (GLfloat)(radius*sin(azimuth*DEG2RAD)*sin(elevation*DEG2RAD));
@@ -227,15 +653,43 @@ int main(int argc, char**argv) {
     // Starts second thread to listen on the command-line.
     thread inputThread(commandListener);
 
-    // Main while loop for rendering.
+    // Main while loop for rendering. Sleeps until an event or command requests a new frame.
+    double min_frame_time = max_fps > 0.0 ? 1.0 / max_fps : 0.0;
+    double last_frame_time = -min_frame_time;
     while (!glfwWindowShouldClose(window) && !quitFlag.load()) {
-        display();
-        glfwPollEvents();
-        glfwSwapBuffers(window);
+        apply_pending_commands();
+        upload_loaded_models();
+
+        bool frame_pending = continuous_mode || frameDirty.load();
+        double wait_time = last_frame_time + min_frame_time - glfwGetTime();
+
+        if (frame_pending && wait_time <= 0.0) {
+            frameDirty.store(false);
+            last_frame_time = glfwGetTime();
+            display();
+            glfwSwapBuffers(window);
+            glfwPollEvents();
+
+            if (first_frame_ms == 0.0) {
+                first_frame_ms = glfwGetTime() * 1000.0;
+                printf("First frame drawn %.1f ms after startup\n", first_frame_ms);
+            }
+        } else if (frame_pending) {
+            // Frame rate cap reached, wait for the rest of the frame interval
+            glfwWaitEventsTimeout(wait_time);
+        } else {
+            glfwWaitEvents();
+        }
     }
 
     // Exit while loop when program is to end and do the following...
+    apply_pending_commands();
     save_state();
+    scene_journal.close();
+
+    for (auto& loader : model_loaders) {
+        loader.second.join();
+    }
 
     quitFlag.store(true);
     inputThread.join();
@@ -251,6 +705,14 @@ void display() {
     proj_matrix = mat4().identity();
     camera_matrix = mat4().identity();
 
+    // Pick up the changes applied since the last frame
+    changed_objects.clear();
+    if (scene_changed || render_cache_stale) {
+        update_render_cache(objects);
+        scene_changed = false;
+        render_cache_stale = false;
+    }
+
     set_background_color();
 
 	// Clear window and depth buffer
@@ -273,6 +735,9 @@ void display() {
     // Set camera matrix
     camera_matrix = lookat(eye, center, up);
 
+    // Upload this frame's matrices once for all draws
+    update_frame_data();
+
     // Render objects
 	render_scene();
 
@@ -285,8 +750,10 @@ void display() {
 
 ///////////////////////////////////////////////////////////////////////
 /// Function: render_scene()                                        ///
-/// Description: Draws all objects in the scene and applies the     ///
-/// corresponding transformations to them.                          ///
+/// Description: Draws all objects in the view volume, batching     ///
+/// them by mesh and level of detail so each batch is drawn with    ///
+/// one instanced call. The level of each object is picked from    ///
+/// its size on screen.                                             ///
 /// Parameters:                                                     ///
 ///     N/A                                                         ///
 /// Return Value:                                                   ///
@@ -294,30 +761,90 @@ void display() {
 ///////////////////////////////////////////////////////////////////////
 
 void render_scene() {
-    // Declare model matrix
-    model_matrix = mat4().identity();
-
-    // Iterates through objects vector and draws each element accordingly.
-    for (const auto& obj : objects) {
-        model_matrix = translate(obj.position) * rotate(obj.angle, 0.0f, 1.0f, 0.0f) * scale(obj.scale);
-
-        if (obj.shape_type == "cube") {
-            draw_color_obj(Cube, ColorLibrary[obj.color]);
-        } else if (obj.shape_type == "cone") {
-            draw_color_obj(Cone, ColorLibrary[obj.color]);
-        } else if (obj.shape_type == "cylinder") {
-            draw_color_obj(Cylinder, ColorLibrary[obj.color]);
-        } else if (obj.shape_type == "sphere") {
-            draw_color_obj(Sphere, ColorLibrary[obj.color]);
-        } else {
-            draw_color_obj(Torus, ColorLibrary[obj.color]);
+    if (gpu_culling) {
+        render_scene_gpu();
+        return;
+    }
+
+    // Reset the instance lists from the previous frame
+    for (model_mesh& mesh : meshes) {
+        for (vector<instance>& level_instances : mesh.instances) {
+            level_instances.clear();
+        }
+    }
+
+    mat4 view_proj = proj_matrix * camera_matrix;
+
+    // Update the culling hierarchy with the bounds of objects changed since the last frame
+    update_scene_bvh();
+
+    // Find the objects inside the view volume
+    visible_objects.clear();
+    scene_bvh.cull(view_frustum::from_matrix(view_proj), scene_cache.bounds, visible_objects);
+
+    // Pixels per world unit at clip w = 1 (the whole frame for the orthographic projection)
+    float pixels_per_unit = 0.5f * hh * proj_matrix[1][1];
+
+    // Groups visible objects by mesh and level of detail, collecting the model matrix and color of each one as an
+    // instance. Meshes that have not been uploaded yet are skipped.
+    size_t drawn = 0;
+    size_t triangles_drawn = 0;
+    size_t lod_objects[MeshMaxLods] = {};
+    for (GLuint i : visible_objects) {
+        model_mesh& mesh = meshes[objects.shapes[i]];
+        if (mesh.num_vertices == 0) {
+            continue;
+        }
+
+        // Screen radius of the mesh, scaled by the object's largest scale factor
+        const vec3& scale = objects.scales[i];
+        vec3 center = scene_cache.bounds[i].center();
+        float w = view_proj[0][3] * center[0] + view_proj[1][3] * center[1] + view_proj[2][3] * center[2] + view_proj[3][3];
+        float max_scale = std::max(fabsf(scale[0]), std::max(fabsf(scale[1]), fabsf(scale[2])));
+        float pixel_radius = mesh.radius * max_scale * pixels_per_unit / std::max(fabsf(w), 1e-6f);
+
+        GLuint level = select_lod(mesh, pixel_radius, scene_cache.lods[i]);
+        scene_cache.lods[i] = (GLubyte)level;
+        mesh.instances[level].push_back(instance(scene_cache.models[i], ColorPalette[objects.colors[i]]));
+        triangles_drawn += mesh.lods[level].index_count / 3;
+        lod_objects[level]++;
+        drawn++;
+    }
+
+    size_t triangles_total = 0;
+    for (GLuint shape : objects.shapes) {
+        const model_mesh& mesh = meshes[shape];
+        if (!mesh.lods.empty()) {
+            triangles_total += mesh.lods[0].index_count / 3;
+        }
+    }
+
+    stats_objects_drawn.store(drawn);
+    stats_objects_total.store(objects.size());
+    stats_bvh_nodes.store(scene_bvh.node_count());
+    stats_triangles_drawn.store(triangles_drawn);
+    stats_triangles_total.store(triangles_total);
+    for (GLuint level = 0; level < MeshMaxLods; level++) {
+        stats_lod_objects[level].store(lod_objects[level]);
+    }
+
+    // Draws every instance of a mesh at one level of detail with a single call, after uploading the instances of
+    // all of them at once.
+    upload_frame_instances();
+    for (model_mesh& mesh : meshes) {
+        for (GLuint level = 0; level < MeshMaxLods; level++) {
+            if (!mesh.instances[level].empty()) {
+                draw_instanced_obj(mesh, level, GL_TRIANGLES);
+            }
         }
     }
 }
 
 ///////////////////////////////////////////////////////////////////////
 /// Function: build_geometry()                                      ///
-/// Description: Sets up the models and colors as well as the axes. ///
+/// Description: Sets up the color palette, the per-frame buffer,   ///
+/// the shared mesh buffers and the axes. Meshes are created as     ///
+/// objects first use them.                                         ///
 /// Parameters:                                                     ///
 ///     N/A                                                         ///
 /// Return Value:                                                   ///
@@ -325,42 +852,14 @@ void render_scene() {
 ///////////////////////////////////////////////////////////////////////
 
 void build_geometry() {
-    // Generate vertex arrays and buffers
-    glGenVertexArrays(NumVAOs, VAOs);
-
-    // Load models
-    load_model(cubeFile, Cube);
-    load_model(coneFile, Cone);
-    load_model(torusFile, Torus);
-    load_model(cylinderFile, Cylinder);
-    load_model(sphereFile, Sphere);
-
-    // Generate color buffers
-    glGenBuffers(NumColorBuffers, ColorBuffers);
-
-    // // Build color buffers and define object vertex color.
-    // Each color from "colorMap" is getting prefixed to each object name.
-    for (const auto& color : colorMap) {
-        const string& colorName = color.first;
-        const vector<float>& colorVec = color.second;
-        vec4 colorValue = vec4(colorVec[0], colorVec[1], colorVec[2], 1.0f);
-
-        // Build color buffers for each shape (e.g., redCube, redCone, redTorus..., blueCube, blueCone, blueTorus...)
-        build_solid_color_buffer(numVertices[Cube], colorValue, ColorLibrary.size());
-        ColorLibrary[colorName + "Cube"] = ColorLibrary.size();
-
-        build_solid_color_buffer(numVertices[Cone], colorValue, ColorLibrary.size());
-        ColorLibrary[colorName + "Cone"] = ColorLibrary.size();
+    // Build the color palette
+    build_color_palette();
 
-        build_solid_color_buffer(numVertices[Torus], colorValue, ColorLibrary.size());
-        ColorLibrary[colorName + "Torus"] = ColorLibrary.size();
+    // Build per-frame uniform buffer
+    build_frame_buffer();
 
-        build_solid_color_buffer(numVertices[Cylinder], colorValue, ColorLibrary.size());
-        ColorLibrary[colorName + "Cylinder"] = ColorLibrary.size();
-
-        build_solid_color_buffer(numVertices[Sphere], colorValue, ColorLibrary.size());
-        ColorLibrary[colorName + "Sphere"] = ColorLibrary.size();
-    }
+    // Build the buffers and vertex arrays every mesh is drawn from
+    build_shared_buffers();
 
     // Build axes
     build_axes();
@@ -430,6 +929,7 @@ void key_callback(GLFWwindow *window, int key, int scancode, int action, int mod
     z = (GLfloat)(radius*cos(azimuth*DEG2RAD)*sin(elevation*DEG2RAD));
     eye = vec3(x,y,z);
 
+    request_redraw();
 }
 
 ///////////////////////////////////////////////////////////////////////
@@ -449,119 +949,229 @@ void commandListener() {
     while (!quitFlag.load()) {
         cout << "\nEnter command: ";
         cin >> command;
-        if (command == "add") {
-            string shape;
-            float x, y, z;
-            cout << "Enter type of shape, position (x y z): ";
-            cin >> shape >> x >> y >> z;
+        if (command == "quit") {
+            quitFlag.store(true);
+            glfwPostEmptyEvent();
+        } else if (command == "help") {
+            print_help();
+        } else if (command == "clear_terminal") {
+            system("cls");
+        } else if (command == "run") {
+            string filename;
+            cout << "Enter script file name: ";
+            cin >> filename;
 
             // Check if input was valid
             if (cin.fail()) {
-                print_failed_command();
+                print_failed_command(cin);
             } else {
-                add_object(shape, x, y, z);
+                run_script(filename);
             }
-        } else if (command == "move") {
-            int index;
-            float dx, dy, dz;
-            cout << "Enter object index and movement vector (dx dy dz): ";
-            cin >> index >> dx >> dy >> dz;
+        } else if (!queue_command(command, cin, true)) {
+            cout << "Not a valid command" << endl;
+        }
+    }
+}
 
-            // Check if input was valid
-            if (cin.fail()) {
-                print_failed_command();
-            } else {
-                move_object(index, dx, dy, dz);
-            }
-        } else if (command == "delete") {
-            int index;
-            cout << "Enter index of object you would like to delete: ";
-            cin >> index;
+///////////////////////////////////////////////////////////////////////
+/// Function: queue_command()                                       ///
+/// Description: Reads the arguments of a scene command and queues  ///
+/// it for the main loop, which applies it at the next frame.       ///
+/// Parameters:                                                     ///
+///    name (string) - The command name.                            ///
+///    in (istream) - Stream the arguments are read from.           ///
+///    interactive (bool) - Prompt for the arguments (terminal).    ///
+///                                                                 ///
+/// Return Value:                                                   ///
+///     false if name is not a scene command, true otherwise        ///
+///////////////////////////////////////////////////////////////////////
 
-            // Check if input was valid
-            if (cin.fail()) {
-                print_failed_command();
-            } else {
-                delete_object(index);
-            }
-        } else if (command == "background") {
-            cout << "Enter a common color name (e.g., blue, red, yellow, etc.): ";
-            cin >> background_color;
+bool queue_command(const string& name, istream& in, bool interactive) {
+    scene_command cmd;
 
-            // Check if input was valid
-            if (cin.fail()) {
-                print_failed_command();
-            } else {
-                background_color = lower_string(background_color);
-            }
-        } else if (command == "quit") {
-            quitFlag.store(true);
-        } else if (command == "load") {
-            load_state();
-        } else if (command == "rotate") {
-            int index;
-            float ang;
-            cout << "Enter object index and angle: ";
-            cin >> index >> ang;
+    if (name == "add") {
+        if (interactive) cout << "Enter type of shape (or an OBJ file), position (x y z) and optionally segments=<n> rings=<n>: ";
+        in >> cmd.name >> cmd.vector[0] >> cmd.vector[1] >> cmd.vector[2];
 
-            // Check if input was valid
-            if (cin.fail()) {
-                print_failed_command();
-            } else {
-                rotate_object(index, ang);
+        // Tessellation parameters on the rest of the line become part of the mesh key (e.g., sphere:segments=24). A
+        // script may end right after the position, leaving no rest of the line to read.
+        string parameters, parameter;
+        if (!in.fail() && !in.eof() && getline(in, parameters)) {
+            istringstream parameter_stream(parameters);
+            while (parameter_stream >> parameter) {
+                cmd.name += ":" + parameter;
             }
-        } else if (command == "scale") {
-            int index;
-            vec3 scale_vector;
-            cout << "Enter object index and scale vector (x, y, z): ";
-            cin >> index >> scale_vector[0] >> scale_vector[1] >> scale_vector[2];
+        }
+        cmd.type = CmdAdd;
+    } else if (name == "move") {
+        if (interactive) cout << "Enter object index and movement vector (dx dy dz): ";
+        in >> cmd.index >> cmd.vector[0] >> cmd.vector[1] >> cmd.vector[2];
+        cmd.type = CmdMove;
+    } else if (name == "delete") {
+        if (interactive) cout << "Enter index of object you would like to delete: ";
+        in >> cmd.index;
+        cmd.type = CmdDelete;
+    } else if (name == "background") {
+        if (interactive) cout << "Enter a common color name (e.g., blue, red, yellow, etc.) or hex color (e.g., #ff8800): ";
+        in >> cmd.name;
+        cmd.type = CmdBackground;
+    } else if (name == "load") {
+        cmd.type = CmdLoad;
+    } else if (name == "import") {
+        if (interactive) cout << "Enter text scene file to add to the scene: ";
+        in >> cmd.name;
+        cmd.type = CmdImport;
+    } else if (name == "export") {
+        if (interactive) cout << "Enter text scene file to write: ";
+        in >> cmd.name;
+        cmd.type = CmdExport;
+    } else if (name == "rotate") {
+        if (interactive) cout << "Enter object index and angle: ";
+        in >> cmd.index >> cmd.vector[0];
+        cmd.type = CmdRotate;
+    } else if (name == "scale") {
+        if (interactive) cout << "Enter object index and scale vector (x, y, z): ";
+        in >> cmd.index >> cmd.vector[0] >> cmd.vector[1] >> cmd.vector[2];
+        cmd.type = CmdScale;
+    } else if (name == "uscale") {
+        if (interactive) cout << "Enter object index and scale factor: ";
+        in >> cmd.index >> cmd.vector[0];
+        cmd.vector[1] = cmd.vector[2] = cmd.vector[0];
+        cmd.type = CmdScale;
+    } else if (name == "clear_canvas") {
+        cmd.type = CmdClearCanvas;
+    } else if (name == "color") {
+        if (interactive) cout << "Enter object index and color name or hex color: ";
+        in >> cmd.index >> cmd.name;
+        cmd.type = CmdColor;
+    } else if (name == "undo") {
+        cmd.type = CmdUndo;
+    } else if (name == "redo") {
+        cmd.type = CmdRedo;
+    } else if (name == "list") {
+        cmd.type = CmdList;
+    } else if (name == "stats") {
+        cmd.type = CmdStats;
+    } else {
+        return false;
+    }
 
-            // Check if input was valid
-            if (cin.fail()) {
-                print_failed_command();
-            } else {
-                scale_object(index, scale_vector);
-            }
-        }  else if (command == "uscale") {
-            int index;
-            vec3 scale_vector;
-            cout << "Enter object index and scale factor: ";
-            cin >> index >> scale_vector[0];
+    // Check if input was valid
+    if (in.fail()) {
+        print_failed_command(in);
+    } else {
+        command_queue.push(cmd);
+        glfwPostEmptyEvent();
+    }
+    return true;
+}
 
-            // Check if input was valid
-            if (cin.fail()) {
-                print_failed_command();
-            } else {
-                scale_vector[1] = scale_vector[2] = scale_vector[0];
-                scale_object(index, scale_vector);
-            }
-        } else if(command == "clear_canvas") {
-            clear_canvas();
-        } else if (command == "color") {  // change color
-            int index;
-            string col_name;
-            cout << "Enter object index and color name: ";
-            cin >> index >> col_name;
+// Queues every command in a script file, given one per line with its arguments as they would be typed.
+void run_script(const string& filename) {
+    ifstream script(filename);
 
-            // Check if input was valid
-            if (cin.fail()) {
-                print_failed_command();
-            } else {
-                assign_color_to_object(index, col_name);
-            }
-        } else if (command == "undo") {
+    if (!script) {
+        cerr << "Error opening script '" << filename << "'!" << endl;
+        return;
+    }
+
+    string command;
+    while (script >> command) {
+        if (!queue_command(command, script, false)) {
+            cerr << "Skipping unknown command '" << command << "' in " << filename << endl;
+            script.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+        }
+    }
+}
+
+// Applies a single queued command. Returns true if it may have changed the scene.
+bool apply_command(const scene_command& cmd) {
+    switch (cmd.type) {
+        case CmdAdd:
+            add_object(cmd.name, cmd.vector[0], cmd.vector[1], cmd.vector[2]);
+            return true;
+        case CmdMove:
+            move_object(cmd.index, cmd.vector[0], cmd.vector[1], cmd.vector[2]);
+            return true;
+        case CmdDelete:
+            delete_object(cmd.index);
+            return true;
+        case CmdRotate:
+            rotate_object(cmd.index, cmd.vector[0]);
+            return true;
+        case CmdScale:
+            scale_object(cmd.index, cmd.vector);
+            return true;
+        case CmdColor:
+            assign_color_to_object(cmd.index, cmd.name);
+            return true;
+        case CmdBackground:
+            record_background();
+            background_color = lower_string(cmd.name);
+            journal_background();
+            return true;
+        case CmdClearCanvas:
+            clear_canvas();
+            return true;
+        case CmdLoad:
+            // The files are read back, so everything changed up to now must be on disk first
+            commit_journal_batch();
+            scene_journal.flush();
+            load_state();
+            return true;
+        case CmdImport:
+            import_scene(cmd.name);
+            return true;
+        case CmdExport:
+            export_scene(cmd.name);
+            return false;
+        case CmdUndo:
             undo_state();
-        } else if (command == "help") {
-            print_help();
-        } else if (command == "list") {
+            return true;
+        case CmdRedo:
+            redo_state();
+            return true;
+        case CmdList:
             list_objects();
-        } else if (command == "clear_terminal") {
-            system("cls");
-        } else {
-            cout << "Not a valid command" << endl;
+            return false;
+        case CmdStats:
+            print_stats();
+            return false;
+    }
+    return false;
+}
+
+///////////////////////////////////////////////////////////////////////
+/// Function: apply_pending_commands()                              ///
+/// Description: Called by the main loop before each frame. Takes   ///
+/// every queued command and applies them as one batch, followed by ///
+/// a single undo step, journal record and scene publish.           ///
+/// Parameters:                                                     ///
+///     N/A                                                         ///
+/// Return Value:                                                   ///
+///     N/A                                                         ///
+///////////////////////////////////////////////////////////////////////
+
+void apply_pending_commands() {
+    command_batch.clear();
+    if (command_queue.drain(command_batch) == 0) {
+        return;
+    }
+
+    bool changed = false;
+    for (const scene_command& cmd : command_batch) {
+        // Close the step of earlier changes in this batch first so undo and redo see them as the latest step
+        if (cmd.type == CmdUndo || cmd.type == CmdRedo) {
+            commit_history_step();
         }
-        save_change_to_stack();
-        save_state();
+        changed |= apply_command(cmd);
+    }
+
+    if (changed) {
+        commit_history_step();
+        commit_journal_batch();
+        scene_changed = true;
+        request_redraw();
     }
 }
 
@@ -597,20 +1207,14 @@ void show_welcome_screen() {
 ///////////////////////////////////////////////////////////////////////
 
 void add_object(string shape, float x, float y, float z) {
-    shape = lower_string(shape);
-
-    if (shape == "cube") {
-        objects.push_back(object(shape, vec3(x, y, z), vec3(1.0f, 1.0f, 1.0f), 0.0f, "redCube"));
-    } else if (shape == "cone") {
-        objects.push_back(object(shape, vec3(x, y, z), vec3(1.0f, 1.0f, 1.0f), 0.0f, "redCone"));
-    } else if (shape == "torus") {
-        objects.push_back(object(shape, vec3(x, y, z), vec3(1.0f, 1.0f, 1.0f), 0.0f, "redTorus"));
-    } else if (shape == "cylinder") {
-        objects.push_back(object(shape, vec3(x, y, z), vec3(1.0f, 1.0f, 1.0f), 0.0f, "redCylinder"));
-    } else if (shape == "sphere") {
-        objects.push_back(object(shape, vec3(x, y, z), vec3(1.0f, 1.0f, 1.0f), 0.0f, "redSphere"));
+    int shape_id = find_shape(shape);
+
+    if (shape_id >= 0) {
+        objects.add(shape_id, vec3(x, y, z), vec3(1.0f, 1.0f, 1.0f), 0.0f, find_color("red"));
+        record_insert(objects.size() - 1);
+        journal_object("insert", objects.size() - 1);
     } else {
-        cerr << "'" << shape << "' is not a valid shape" << endl;
+        cerr << "'" << shape << "' is not a valid shape, tessellation or OBJ file" << endl;
     }
 }
 
@@ -629,7 +1233,10 @@ void add_object(string shape, float x, float y, float z) {
 
 void move_object(int index, float dx, float dy, float dz) {
     if (index >= 0 && index < objects.size()) {
-        objects[index].position += vec3(dx, dy, dz);
+        record_modify(index);
+        objects.positions[index] += vec3(dx, dy, dz);
+        objects.mark_dirty(index);
+        journal_object("set", index);
     } else {
         cout << "Invalid object index." << endl;
     }
@@ -638,7 +1245,9 @@ void move_object(int index, float dx, float dy, float dz) {
 // Deletes the element from the objects vector with the passed index.
 void delete_object(int index) {
     if (index >= 0 && index < objects.size()) {
-        objects.erase(objects.begin() + index);
+        record_erase(index);
+        objects.erase(index);
+        journal_erase(index);
     } else {
         cout << "Invalid object index." << endl;
     }
@@ -647,7 +1256,10 @@ void delete_object(int index) {
 // Sets the rotation angle of the element from the objects vector with the passed index and angle.
 void rotate_object(int index, float ang) {
     if (index >= 0 && index < objects.size()) {
-        objects[index].angle = ang;
+        record_modify(index);
+        objects.angles[index] = ang;
+        objects.mark_dirty(index);
+        journal_object("set", index);
     } else {
         cout << "Invalid object index." << endl;
     }
@@ -656,13 +1268,16 @@ void rotate_object(int index, float ang) {
 // Sets the scale of the element from the objects vector with the passed index and scale.
 void scale_object(int index, vec3 scale_vector) {
     if (index >= 0 && index < objects.size()) {
-        objects[index].scale = scale_vector;
+        record_modify(index);
+        objects.scales[index] = scale_vector;
+        objects.mark_dirty(index);
+        journal_object("set", index);
     } else {
         cout << "Invalid object index." << endl;
     }
 }
 
-// Gets the rgb values of the new background color and clears the color buffers with the new rgb values.
+// Sets the clear color to the background color of the scene.
 void set_background_color() {
     // Get RGB value of user-inputted color
     vector<float> color_rgb = get_color_rgb(background_color);
@@ -671,134 +1286,608 @@ void set_background_color() {
     glClearColor(color_rgb[0],color_rgb[1],color_rgb[2],1.0f);
 }
 
-// Saves the current states of the program in a .txt file called "save.txt" in /bin.
+///////////////////////////////////////////////////////////////////////
+/// Function: save_state()                                          ///
+/// Description: Queues a snapshot of the scene to replace          ///
+/// "save.bin" in /bin. The I/O thread writes it to a temporary     ///
+/// file, renames it over the old one and then empties the journal. ///
+/// Parameters:                                                     ///
+///     N/A                                                         ///
+/// Return Value:                                                   ///
+///     N/A                                                         ///
+///////////////////////////////////////////////////////////////////////
+
 void save_state() {
-    ofstream save_file("save.txt");
+    // The I/O thread writes from its own copy, the scene may change again before it gets to it
+    object_store saved_objects = objects;
+    vector<string> saved_shapes = MeshNames;
+    vector<string> saved_names = ColorNames;
+    string saved_background = background_color;
+    unsigned long long saved_sequence = journal_sequence;
+
+    scene_journal.write_snapshot([saved_objects, saved_shapes, saved_names, saved_background, saved_sequence](ostream& out) {
+        write_scene(out, saved_objects, saved_shapes, saved_names, saved_background, saved_sequence);
+    });
+    journal_bytes = 0;
+}
 
-    if (!save_file) {
-        cerr << "Error opening save file!" << endl;
-        return;
+///////////////////////////////////////////////////////////////////////
+/// Function: write_scene()                                         ///
+/// Description: Writes a binary scene file (see scenefile.h) in    ///
+/// one pass: header, one fixed-size record per object, then the    ///
+/// string table with the mesh keys, the color names (in palette   ///
+/// order) and the background color.                                ///
+/// Parameters:                                                     ///
+///    out (ostream) - Binary stream to write to.                   ///
+///    store, shape_names, color_names, background - The scene to   ///
+///        write.                                                   ///
+///    sequence (unsigned long long) - Last journaled batch in it.  ///
+///                                                                 ///
+/// Return Value:                                                   ///
+///     N/A                                                         ///
+///////////////////////////////////////////////////////////////////////
+
+void write_scene(ostream& out, const object_store& store, const vector<string>& shape_names, const vector<string>& color_names,
+                 const string& background, unsigned long long sequence) {
+    const uint32_t color_base = (uint32_t)shape_names.size();
+    const uint32_t background_index = color_base + (uint32_t)color_names.size();
+
+    vector<const string*> strings;
+    for (const string& name : shape_names) {
+        strings.push_back(&name);
+    }
+    for (const string& name : color_names) {
+        strings.push_back(&name);
     }
+    strings.push_back(&background);
 
-    // Save data
-    save_file << "background_color: " << background_color << "\n" << endl;
-    for (int i = 0; i < objects.size(); i++) {
-        save_file << i << ": " << objects[i].shape_type << " "
-                  << objects[i].position[0] << " "
-                  << objects[i].position[1] << " "
-                  << objects[i].position[2] << " "
-                  << objects[i].scale[0] << " "
-                  << objects[i].scale[1] << " "
-                  << objects[i].scale[2] << " "
-                  << objects[i].angle << " "
-                  << objects[i].color << "\n";
+    uint32_t string_data_size = 0;
+    for (const string* name : strings) {
+        string_data_size += (uint32_t)name->size();
     }
 
-    save_file.close();
+    scene_file_header header;
+    memcpy(header.magic, SceneFileMagic, sizeof(header.magic));
+    header.version = SceneFileVersion;
+    header.object_count = (uint32_t)store.size();
+    header.object_offset = sizeof(scene_file_header);
+    header.string_count = (uint32_t)strings.size();
+    header.string_offset = header.object_offset + header.object_count * sizeof(scene_file_object);
+    header.string_data_offset = header.string_offset + header.string_count * sizeof(scene_file_string);
+    header.string_data_size = string_data_size;
+    header.background = background_index;
+    header.reserved = 0;
+    header.journal_sequence = sequence;
+    out.write((const char*)&header, sizeof(header));
+
+    for (size_t i = 0; i < store.size(); i++) {
+        scene_file_object object;
+        for (int c = 0; c < 3; c++) {
+            object.position[c] = store.positions[i][c];
+            object.scale[c] = store.scales[i][c];
+        }
+        object.angle = store.angles[i];
+        object.shape = store.shapes[i];
+        object.color = color_base + store.colors[i];
+        out.write((const char*)&object, sizeof(object));
+    }
+
+    uint32_t offset = 0;
+    for (const string* name : strings) {
+        scene_file_string entry;
+        entry.offset = offset;
+        entry.length = (uint32_t)name->size();
+        out.write((const char*)&entry, sizeof(entry));
+        offset += entry.length;
+    }
+    for (const string* name : strings) {
+        out.write(name->data(), name->size());
+    }
 }
 
-// Reads the information from the "save.txt" file from /bin and sets everything accordingly.
-void load_state() {
-    ifstream load_file("save.txt");
+// Reads the saved scene (the snapshot in "save.bin" plus the batches journaled after it) and adds it to the scene.
+// Returns the size of the journal up to its last complete batch.
+size_t load_state() {
+    object_store saved_objects;
+    string saved_background = background_color;
+    unsigned long long saved_sequence = 0;
+
+    if (!read_snapshot(saved_objects, saved_background, saved_sequence)) {
+        // Scenes saved before the binary format was introduced
+        ifstream text_file(textSaveFile);
+        if (!text_file || !read_text_scene(text_file, saved_objects, saved_background, saved_sequence)) {
+            cerr << "No save file found, loading default..." << endl;
+        }
+    }
+    size_t journal_size = replay_journal(saved_objects, saved_background, saved_sequence);
+    journal_sequence = std::max(journal_sequence, saved_sequence);
 
-    if (!load_file) {
-        cerr << "No save file found, loading default..." << endl;
-        return;
+    add_saved_scene(saved_objects, saved_background);
+    return journal_size;
+}
+
+///////////////////////////////////////////////////////////////////////
+/// Function: read_snapshot()                                       ///
+/// Description: Maps "save.bin" into memory and copies its objects ///
+/// into store. Names in the string table are resolved once each,   ///
+/// after which every object is a fixed-size record to copy.        ///
+/// Parameters:                                                     ///
+///    store (object_store) - Receives the objects.                 ///
+///    background (string) - Receives the background color.         ///
+///    sequence (unsigned long long) - Receives the last journaled  ///
+///        batch included in the snapshot.                          ///
+///                                                                 ///
+/// Return Value:                                                   ///
+///     false if there is no valid snapshot, true otherwise         ///
+///////////////////////////////////////////////////////////////////////
+
+bool read_snapshot(object_store& store, string& background, unsigned long long& sequence) {
+    mapped_file file;
+    if (!file.open(saveFile)) {
+        return false;
+    }
+
+    const scene_file_header* header = check_scene_file(file.data(), file.size());
+    if (!header) {
+        cerr << "'" << saveFile << "' is not a valid scene file, ignoring it" << endl;
+        return false;
+    }
+
+    // Shape and palette index of each string, looked up when an object first uses it
+    const int Unresolved = -2;
+    vector<int> shape_ids(header->string_count, Unresolved);
+    vector<int> color_ids(header->string_count, Unresolved);
+    int default_color = find_color("red");
+
+    const scene_file_object* records = scene_file_objects(header);
+    store.positions.reserve(store.size() + header->object_count);
+    store.scales.reserve(store.size() + header->object_count);
+    store.angles.reserve(store.size() + header->object_count);
+    store.shapes.reserve(store.size() + header->object_count);
+    store.colors.reserve(store.size() + header->object_count);
+    store.revisions.reserve(store.size() + header->object_count);
+
+    for (uint32_t i = 0; i < header->object_count; i++) {
+        const scene_file_object& record = records[i];
+
+        int& shape_id = shape_ids[record.shape];
+        if (shape_id == Unresolved) {
+            shape_id = find_shape(scene_file_string_at(header, record.shape));
+            if (shape_id < 0) {
+                cerr << "'" << scene_file_string_at(header, record.shape) << "' is not a valid shape, skipping its objects" << endl;
+            }
+        }
+        if (shape_id < 0) {
+            continue;
+        }
+
+        int& color_id = color_ids[record.color];
+        if (color_id == Unresolved) {
+            color_id = find_color(normalize_color_name(scene_file_string_at(header, record.color)));
+            if (color_id < 0) {
+                cerr << "Color '" << scene_file_string_at(header, record.color) << "' not found, using red" << endl;
+                color_id = default_color;
+            }
+        }
+
+        store.add(shape_id, vec3(record.position[0], record.position[1], record.position[2]),
+                  vec3(record.scale[0], record.scale[1], record.scale[2]), record.angle, color_id);
+    }
+
+    background = scene_file_string_at(header, header->background);
+    sequence = header->journal_sequence;
+    return true;
+}
+
+// Writes the scene in the text save format: the background color and then one line per object.
+void write_text_scene(ostream& out, const object_store& store, const vector<string>& shape_names, const vector<string>& color_names,
+                      const string& background) {
+    out << "background_color: " << background << "\n\n";
+    for (size_t i = 0; i < store.size(); i++) {
+        write_object(out, i, store, shape_names, color_names);
     }
+}
 
+// Reads a scene in the text save format into store. Returns false if nothing could be read.
+bool read_text_scene(istream& in, object_store& store, string& background, unsigned long long& sequence) {
     string key;
-    string shape_type;
-    vec3 position;
-    vec3 scale_vector;
-    float angle;
-    string color;
-    while (load_file >> key) {
+    object_record object;
+    bool found = false;
+
+    while (in >> key) {
         if (key == "background_color:") {
-            load_file >> background_color;
+            in >> background;
+            found = true;
+        } else if (key == "journal_sequence:") {
+            in >> sequence;
         } else if (isdigit(key[0])) { // Check if the key starts with a digit
-            load_file >> shape_type >> position[0] >> position[1] >> position[2] >> scale_vector[0] >> scale_vector[1] >> scale_vector[2] >> angle >> color;
-            objects.push_back(object(shape_type, position, scale_vector, angle, color));
+            if (read_object(in, object)) {
+                store.insert(store.size(), object);
+                found = true;
+            }
         }
     }
+    return found;
 }
 
-// Pops off the top element from the "state_stack" which undoes the most recent change.
-void undo_state() {
-    if (state_stack.empty()) {
-        cerr << "Undo stack is empty!" << endl;
+// Adds objects and a background color read from a file to the scene, recording them for undo and in the journal.
+void add_saved_scene(const object_store& store, const string& background) {
+    if (background != background_color) {
+        record_background();
+        background_color = background;
+        journal_background();
+    }
+    for (size_t i = 0; i < store.size(); i++) {
+        objects.insert(objects.size(), store.get(i));
+        record_insert(objects.size() - 1);
+        journal_object("insert", objects.size() - 1);
+    }
+}
+
+// Adds the scene in a text save file to the current one.
+void import_scene(const string& filename) {
+    ifstream in(filename);
+    if (!in) {
+        cerr << "Error opening '" << filename << "'!" << endl;
         return;
     }
 
-    // Pop the current state
-    state_stack.pop();
+    object_store imported;
+    string imported_background = background_color;
+    unsigned long long ignored_sequence = 0;
+    if (!read_text_scene(in, imported, imported_background, ignored_sequence)) {
+        cerr << "No scene found in '" << filename << "'" << endl;
+        return;
+    }
+    add_saved_scene(imported, imported_background);
+    cout << "Imported " << imported.size() << " objects from " << filename << endl;
+}
 
-    if (!state_stack.empty()) {
-        // Load the previous state
-        load_change_from_stack(state_stack.top());
-    } else {
-        cerr << "No more states to undo to!" << endl;
+// Writes the current scene to a text save file.
+void export_scene(const string& filename) {
+    ofstream out(filename);
+    if (!out) {
+        cerr << "Error opening '" << filename << "'!" << endl;
+        return;
     }
+
+    write_text_scene(out, objects, MeshNames, ColorNames, background_color);
+    cout << "Exported " << objects.size() << " objects to " << filename << endl;
 }
 
-// Pushes the current state of the program to the "state_stack", and does this for each change.
-void save_change_to_stack() {
-    ostringstream state_stream;
+///////////////////////////////////////////////////////////////////////
+/// Function: replay_journal()                                      ///
+/// Description: Applies the batches in the journal that are newer  ///
+/// than the snapshot to store. A batch is only applied once its    ///
+/// commit line was written, so a torn write at the end is ignored. ///
+/// Parameters:                                                     ///
+///    store (object_store) - Objects read from the snapshot.       ///
+///    background (string) - Background color from the snapshot.   ///
+///    sequence (unsigned long long) - Last batch in the snapshot,  ///
+///        updated to the last batch applied.                       ///
+///                                                                 ///
+/// Return Value:                                                   ///
+///     Size of the journal up to the end of its last commit line,  ///
+///     the part to keep when appending to it.                      ///
+///////////////////////////////////////////////////////////////////////
+
+size_t replay_journal(object_store& store, string& background, unsigned long long& sequence) {
+    ifstream journal_file(journalFile, ios::binary);
+    size_t valid_size = 0;
 
-    // Serialize current state
-    state_stream << "background_color: " << background_color << "\n";
-    for (int i = 0; i < objects.size(); i++) {
-        state_stream << i << ": " << objects[i].shape_type << " "
-                     << objects[i].position[0] << " "
-                     << objects[i].position[1] << " "
-                     << objects[i].position[2] << " "
-                     << objects[i].scale[0] << " "
-                     << objects[i].scale[1] << " "
-                     << objects[i].scale[2] << " "
-                     << objects[i].angle << " "
-                     << objects[i].color << "\n";
+    if (!journal_file) {
+        return valid_size;
     }
 
-    string new_state = state_stream.str();
-    if (state_stack.empty() || state_stack.top() != new_state) {
-        state_stack.push(new_state);
+    string line;
+    string batch;
+    // A line cut off by the end of the file (no newline) was torn, even if it reads like a commit
+    while (getline(journal_file, line) && !journal_file.eof()) {
+        if (line.compare(0, 7, "commit ") == 0) {
+            // Batches up to the snapshot's sequence are already in it (left over from a compaction cut short)
+            unsigned long long batch_sequence = strtoull(line.c_str() + 7, nullptr, 10);
+            if (batch_sequence > sequence) {
+                istringstream batch_stream(batch);
+                apply_journal_batch(batch_stream, store, background);
+                sequence = batch_sequence;
+            }
+            batch.clear();
+            valid_size = (size_t)journal_file.tellg();
+        } else {
+            batch += line;
+            batch += '\n';
+        }
     }
+    return valid_size;
 }
 
-// Called from the "undo_state" function, overwriting all current data with the data from the top of the "state_stack".
-void load_change_from_stack(const string& state) {
-    istringstream state_stream(state);
-    string key;
-    string shape_type;
-    vec3 position;
-    vec3 scale_vector;
-    float angle;
-    string color;
+// Applies the lines of one journaled batch to store.
+void apply_journal_batch(istream& in, object_store& store, string& background) {
+    string op;
+    string index_field;
+    object_record object;
+
+    while (in >> op) {
+        if (op == "insert" || op == "set") {
+            in >> index_field;
+            size_t index = strtoul(index_field.c_str(), nullptr, 10);
+            if (!read_object(in, object)) {
+                continue;
+            }
+            if (op == "insert" && index <= store.size()) {
+                store.insert(index, object);
+            } else if (op == "set" && index < store.size()) {
+                store.set(index, object);
+            }
+        } else if (op == "erase") {
+            size_t index;
+            in >> index;
+            if (in && index < store.size()) {
+                store.erase(index);
+            }
+        } else if (op == "clear") {
+            store.clear();
+        } else if (op == "background") {
+            in >> background;
+        }
+    }
+}
 
-    objects.clear();
-    while (state_stream >> key) {
-        if (key == "background_color:") {
-            state_stream >> background_color;
-        } else if (isdigit(key[0])) { // Check if the key starts with a digit
-            state_stream >> shape_type >> position[0] >> position[1] >> position[2] >> scale_vector[0] >> scale_vector[1] >> scale_vector[2] >> angle >> color;
-            objects.push_back(object(shape_type, position, scale_vector, angle, color));
+// Adds an "insert" or "set" line with the current fields of an object to the journal batch.
+void journal_object(const char* op, size_t index) {
+    journal_batch << op << " ";
+    write_object(journal_batch, index, objects, MeshNames, ColorNames);
+}
+
+void journal_erase(size_t index) {
+    journal_batch << "erase " << index << "\n";
+}
+
+void journal_clear() {
+    journal_batch << "clear\n";
+}
+
+void journal_background() {
+    journal_batch << "background " << background_color << "\n";
+}
+
+// Hands the journal lines of the applied batch to the I/O thread as one record, and compacts the journal into a new
+// snapshot once it is larger than the snapshot would be (so rewriting the snapshot costs O(1) per change on average).
+void commit_journal_batch() {
+    if (journal_batch.tellp() <= 0) {
+        return;
+    }
+
+    journal_batch << "commit " << ++journal_sequence << "\n";
+    string record = journal_batch.str();
+    journal_batch.str("");
+    journal_bytes += record.size();
+    scene_journal.append(std::move(record));
+
+    if (journal_bytes > JournalCompactBytes && journal_bytes > objects.size() * 64) {
+        save_state();
+    }
+}
+
+// Records that an object was just inserted at index, so undo erases it.
+void record_insert(size_t index) {
+    history_change change;
+    change.kind = HistErase;
+    change.index = index;
+    pending_step.changes.push_back(change);
+}
+
+// Records an object about to be erased from index, so undo inserts it back.
+void record_erase(size_t index) {
+    history_change change;
+    change.kind = HistInsert;
+    change.index = index;
+    change.object = objects.get(index);
+    pending_step.changes.push_back(change);
+}
+
+// Records the values of an object about to be modified, so undo sets them back.
+void record_modify(size_t index) {
+    history_change change;
+    change.kind = HistSet;
+    change.index = index;
+    change.object = objects.get(index);
+    pending_step.changes.push_back(change);
+}
+
+// Records the background color about to be replaced. Only the first one in a step is needed.
+void record_background() {
+    if (!pending_step.has_background) {
+        pending_step.has_background = true;
+        pending_step.background = background_color;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////
+/// Function: commit_history_step()                                 ///
+/// Description: Closes the changes recorded since the last call    ///
+/// into one undo step. Anything that could be redone is dropped,   ///
+/// and old steps are compacted or dropped to stay under the cap.   ///
+/// Parameters:                                                     ///
+///     N/A                                                         ///
+/// Return Value:                                                   ///
+///     N/A                                                         ///
+///////////////////////////////////////////////////////////////////////
+
+void commit_history_step() {
+    if (pending_step.changes.empty() && !pending_step.has_background) {
+        return;
+    }
+
+    // A new change makes the undone steps unreachable
+    while (history.size() > history_cursor) {
+        history_bytes -= history_step_bytes(history.back());
+        history.pop_back();
+    }
+
+    compact_history_step(pending_step);
+    history.push_back(history_step());
+    history.back().changes.swap(pending_step.changes);
+    history.back().has_background = pending_step.has_background;
+    history.back().background.swap(pending_step.background);
+    pending_step.has_background = false;
+    pending_step.background.clear();
+
+    history_bytes += history_step_bytes(history.back());
+    history_cursor = history.size();
+    trim_history();
+}
+
+// Applies the changes of a step last to first, leaving the changes that revert them in their place.
+void apply_history_step(history_step& step) {
+    vector<history_change> reverted;
+    reverted.reserve(step.changes.size());
+
+    for (size_t i = step.changes.size(); i-- > 0;) {
+        history_change change = step.changes[i];
+        if (change.kind == HistInsert) {
+            objects.insert(change.index, change.object);
+            journal_object("insert", change.index);
+            change.kind = HistErase;
+        } else if (change.kind == HistErase) {
+            change.object = objects.get(change.index);
+            objects.erase(change.index);
+            journal_erase(change.index);
+            change.kind = HistInsert;
+        } else {
+            object_record values = objects.get(change.index);
+            objects.set(change.index, change.object);
+            journal_object("set", change.index);
+            change.object = values;
         }
+        reverted.push_back(change);
+    }
+    step.changes.swap(reverted);
+
+    if (step.has_background) {
+        swap(background_color, step.background);
+        journal_background();
     }
 }
 
+// Drops changes of an undoable step that are overridden by others in it. Changes are applied last to first, so of
+// several sets to one object only the first one has a lasting effect, as long as no insert or erase (which moves
+// objects between indices) comes between them.
+void compact_history_step(history_step& step) {
+    unordered_set<GLuint> set_objects;
+    size_t kept = 0;
+
+    for (size_t i = 0; i < step.changes.size(); i++) {
+        const history_change& change = step.changes[i];
+        if (change.kind != HistSet) {
+            set_objects.clear();
+        } else if (!set_objects.insert(change.index).second) {
+            continue;
+        }
+        step.changes[kept++] = change;
+    }
+    step.changes.resize(kept);
+    step.changes.shrink_to_fit();
+}
+
+// Approximate memory used by a step.
+size_t history_step_bytes(const history_step& step) {
+    return sizeof(history_step) + step.changes.capacity() * sizeof(history_change) + step.background.capacity();
+}
+
+///////////////////////////////////////////////////////////////////////
+/// Function: trim_history()                                        ///
+/// Description: Keeps the history under history_limit. The two     ///
+/// oldest steps are merged into one checkpoint step (undoing it    ///
+/// goes straight back to the state before both) when that saves   ///
+/// memory, otherwise the oldest step is dropped.                   ///
+/// Parameters:                                                     ///
+///     N/A                                                         ///
+/// Return Value:                                                   ///
+///     N/A                                                         ///
+///////////////////////////////////////////////////////////////////////
+
+void trim_history() {
+    // Only undoable steps are trimmed, and the latest one is always kept
+    while (history_bytes > history_limit && history_cursor > 1) {
+        history_step& oldest = history[0];
+        history_step& next = history[1];
+        size_t separate_bytes = history_step_bytes(oldest) + history_step_bytes(next);
+
+        // The oldest step is undone last, and changes are applied last to first, so its changes go first
+        history_step merged;
+        merged.changes.reserve(oldest.changes.size() + next.changes.size());
+        merged.changes.insert(merged.changes.end(), oldest.changes.begin(), oldest.changes.end());
+        merged.changes.insert(merged.changes.end(), next.changes.begin(), next.changes.end());
+        merged.has_background = oldest.has_background || next.has_background;
+        merged.background = oldest.has_background ? oldest.background : next.background;
+        compact_history_step(merged);
+
+        size_t merged_bytes = history_step_bytes(merged);
+        history_bytes -= separate_bytes;
+        history.pop_front();
+        if (merged_bytes < separate_bytes) {
+            swap(history[0], merged);
+            history_bytes += merged_bytes;
+        } else {
+            history_bytes += history_step_bytes(history[0]);
+        }
+        history_cursor--;
+    }
+}
+
+// Reverts the most recent undoable step.
+void undo_state() {
+    if (history_cursor == 0) {
+        cerr << "Nothing to undo!" << endl;
+        return;
+    }
+
+    history_cursor--;
+    history_step& step = history[history_cursor];
+
+    // Applying a step rebuilds its change list and swaps its background, so its size changes
+    history_bytes -= history_step_bytes(step);
+    apply_history_step(step);
+    history_bytes += history_step_bytes(step);
+}
+
+// Reapplies the most recently undone step.
+void redo_state() {
+    if (history_cursor == history.size()) {
+        cerr << "Nothing to redo!" << endl;
+        return;
+    }
+
+    history_step& step = history[history_cursor];
+    history_bytes -= history_step_bytes(step);
+    apply_history_step(step);
+    history_bytes += history_step_bytes(step);
+    history_cursor++;
+}
+
 // Clears the object vector, making it empty.
 void clear_canvas() {
+    // Erasing from the back keeps each recorded index valid and each undo insert an append
+    for (size_t i = objects.size(); i-- > 0;) {
+        record_erase(i);
+    }
     objects.clear();
+    journal_clear();
 }
 
-// Changes the color field of the corresponding object to the passed colorName.
+// Changes the color field of the corresponding object to the passed colorName (a color name or hex color).
 void assign_color_to_object(int index, const string& colorName) {
     if (index < 0 || index >= objects.size()) {
         cout << "Invalid object index." << endl;
         return;
     }
 
-    if (ColorLibrary.find(colorName) != ColorLibrary.end()) {
-        objects[index].color = colorName;
+    int color = find_color(normalize_color_name(colorName));
+    if (color >= 0) {
+        record_modify(index);
+        objects.colors[index] = color;
+        journal_object("set", index);
         cout << "Assigned color '" << colorName << "' to object ID " << index << endl;
     } else {
         cerr << "Color '" << colorName << "' not found!" << endl;
@@ -808,20 +1897,27 @@ void assign_color_to_object(int index, const string& colorName) {
 // Prints a complete list of all avaliable commands to the terminal.
 void print_help() {
     cout << "Available Commands:\n";
-    cout << "  add <shape> <x> <y> <z>                         - Add a new object to the scene\n";
+    cout << "  add <shape> <x> <y> <z> [segments=<n>] [rings=<n>] - Add a new object to the scene\n";
+    cout << "                                                    (cube, cone, torus, cylinder or sphere)\n";
+    cout << "  add <file.obj> <x> <y> <z>                      - Add an object with a mesh loaded from an OBJ file\n";
     cout << "  move <index> <dx> <dy> <dz>                     - Move an object in the scene\n";
     cout << "  scale <index> <scale_vector>                    - Scale an object in the scene\n";
     cout << "  uscale <index> <scale_factor>                   - Scale an object in the scene uniformly\n";
     cout << "  rotate <index> <angle>                          - Rotate an object in the scene\n";
     cout << "  delete <index>                                  - Delete an object by its index\n";
-    cout << "  color <index> <color_name>                      - Change the color of a specified object\n";
-    cout << "  background <color_name>                         - Change the background color\n";
+    cout << "  color <index> <color_name|#rrggbb[aa]>          - Change the color of a specified object\n";
+    cout << "  background <color_name|#rrggbb>                 - Change the background color\n";
     cout << "  clear_canvas                                    - Clear the canvas of all objects\n";
     cout << "  clear_terminal                                  - Clear the terminal\n";
     cout << "  undo                                            - Undo the last action\n";
+    cout << "  redo                                            - Redo the last undone action\n";
+    cout << "  run <file>                                      - Run the commands in a script file\n";
     cout << "  save                                            - Save the current state to a file\n";
     cout << "  load                                            - Load the state from a file\n";
+    cout << "  import <file>                                   - Add the scene in a text save file\n";
+    cout << "  export <file>                                   - Write the scene to a text save file\n";
     cout << "  list                                            - List all objects in the scene\n";
+    cout << "  stats                                           - Show rendering statistics since the last call\n";
     cout << "  help                                            - Display this help message\n";
     cout << "  quit                                            - Exit the program\n";
 }
@@ -836,16 +1932,91 @@ void list_objects() {
     cout << "Objects in the scene:\n";
     for (size_t i = 0; i < objects.size(); ++i) {
         cout << i << ": "
-                  << "Shape: " << objects[i].shape_type << ", "
-                  << "Position: (" << objects[i].position[0] << ", "
-                  << objects[i].position[1] << ", "
-                  << objects[i].position[2] << "), "
-                  << "Scale: (" << objects[i].scale[0] << ", "
-                  << objects[i].scale[1] << ", "
-                  << objects[i].scale[2] << "), "
-                  << "Angle: " << objects[i].angle << ", "
-                  << "Color: " << objects[i].color << "\n";
+                  << "Shape: " << MeshNames[objects.shapes[i]] << ", "
+                  << "Position: (" << objects.positions[i][0] << ", "
+                  << objects.positions[i][1] << ", "
+                  << objects.positions[i][2] << "), "
+                  << "Scale: (" << objects.scales[i][0] << ", "
+                  << objects.scales[i][1] << ", "
+                  << objects.scales[i][2] << "), "
+                  << "Angle: " << objects.angles[i] << ", "
+                  << "Color: " << ColorNames[objects.colors[i]] << "\n";
+    }
+}
+
+// Prints how many GL state changes were issued and skipped as redundant since the last call, then resets the counters.
+void print_stats() {
+    const GLStateCounters& counters = glsCounters();
+    const pair<const char*, GLStateCounter> entries[] = {
+        {"Program binds", counters.program},
+        {"Vertex array binds", counters.vertexArray},
+        {"Buffer binds", counters.buffer}
+    };
+
+    if (gpu_culling) {
+        read_gpu_culling_stats();
+    }
+    cout << "Culling: " << (gpu_culling ? (occlusion_culling ? "GPU, with occlusion" : "GPU") : "CPU") << "\n";
+
+    size_t drawn = stats_objects_drawn.load();
+    size_t total = stats_objects_total.load();
+    cout << "Objects drawn last frame: " << drawn << " of " << total << " (" << total - drawn << " culled, ";
+    if (occlusion_culling) {
+        cout << stats_objects_occluded.load() << " of them by occlusion, ";
+    }
+    cout << stats_bvh_nodes.load() << " BVH nodes)\n";
+    size_t triangles_drawn = stats_triangles_drawn.load();
+    size_t triangles_total = stats_triangles_total.load();
+    cout << "Triangles drawn last frame: " << triangles_drawn << " of " << triangles_total << " in the scene at full detail";
+    if (triangles_total > 0) {
+        cout << " (" << 100.0 * triangles_drawn / triangles_total << "%)";
+    }
+    cout << ", objects per LOD:";
+    for (GLuint level = 0; level < MeshMaxLods; level++) {
+        cout << " " << stats_lod_objects[level].load();
+    }
+    cout << "\n";
+    cout << "Undo history: " << history_cursor << " undo / " << history.size() - history_cursor << " redo steps, "
+         << history_bytes / 1024 << " KB of " << history_limit / 1024 << " KB\n";
+    cout << "Startup: first frame after " << first_frame_ms << " ms";
+    if (models_loaded_ms > 0.0) {
+        cout << ", scene meshes generated after " << models_loaded_ms << " ms";
+    }
+    if (models_pending > 0) {
+        cout << ", " << models_pending << " meshes still generating";
+    }
+    cout << "\n";
+    cout << "Shared mesh buffers: " << (size_t)vertex_arena.used() * modelLayout.stride / 1024 << " of "
+         << (size_t)vertex_arena.capacity() * modelLayout.stride / 1024 << " KB of vertices, "
+         << (size_t)index_arena.used() * sizeof(GLuint) / 1024 << " of " << (size_t)index_arena.capacity() * sizeof(GLuint) / 1024
+         << " KB of indices\n";
+    cout << "Meshes (triangles, vertices unindexed -> indexed, ACMR in generated -> optimized order, vertex memory as floats -> packed,\n"
+         << "        triangles of each level of detail):\n";
+    for (size_t id = 0; id < meshes.size(); id++) {
+        const model_mesh& mesh = meshes[id];
+        if (mesh.num_vertices == 0) {
+            continue;
+        }
+        size_t float_bytes = sizeof(GLfloat) * (posCoords + normCoords + texCoords);
+        cout << "  " << MeshNames[id] << ": " << mesh.num_indices / 3 << ", "
+             << mesh.stats.source_vertex_count << " -> " << mesh.num_vertices << ", "
+             << mesh.stats.welded_acmr << " -> " << mesh.stats.optimized_acmr << ", "
+             << mesh.stats.source_vertex_count * float_bytes / 1024 << " KB -> "
+             << (mesh.num_vertices * modelLayout.stride + mesh.num_indices * sizeof(GLuint)) / 1024 << " KB, LODs";
+        for (const mesh_file_lod& lod : mesh.lods) {
+            cout << " " << lod.index_count / 3;
+        }
+        cout << "\n";
+    }
+    cout << "Vertex layout: " << modelLayout.stride << " bytes (position" << (modelLayout.attributes & VertexNormal ? ", normal" : "")
+         << (modelLayout.attributes & VertexTexCoord ? ", texcoord" : "") << ") instead of " << sizeof(GLfloat) * (posCoords + normCoords + texCoords) << "\n";
+    cout << "Journal: " << scene_journal.record_count() << " batches in " << scene_journal.commit_count()
+         << " writes, " << journal_bytes / 1024 << " KB since the last snapshot\n";
+    cout << "GL state changes (issued / skipped as redundant):\n";
+    for (const auto& entry : entries) {
+        cout << "  " << entry.first << ": " << entry.second.issued << " / " << entry.second.skipped << "\n";
     }
+    glsResetCounters();
 }
 
 
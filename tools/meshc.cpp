@@ -0,0 +1,57 @@
+// OpenConsole - mesh compiler
+// Compiles OBJ files into the binary mesh cache the program maps when 'add' is given an OBJ file, e.g. as a build step:
+//     meshc ../models/*.obj
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include "../common/meshcache.h"
+
+int main(int argc, char**argv) {
+    if (argc < 2) {
+        printf("Usage: %s [--force] <file.obj>...\n", argv[0]);
+        printf("Writes <file.obj>.mesh for each file whose cache is missing or out of date.\n");
+        return 1;
+    }
+
+    bool force = false;
+    int failed = 0;
+    for (int i = 1; i < argc; i++) {
+        const char * obj_path = argv[i];
+        if (strcmp(obj_path, "--force") == 0) {
+            force = true;
+            continue;
+        }
+
+        mesh_source_key key;
+        if (!get_mesh_source_key(obj_path, key)) {
+            fprintf(stderr, "%s: cannot open file\n", obj_path);
+            failed++;
+            continue;
+        }
+
+        std::string cache_path = mesh_cache_path(obj_path);
+        mesh_cache existing;
+        if (!force && existing.open(cache_path.c_str(), &key)) {
+            printf("%s is up to date\n", cache_path.c_str());
+            continue;
+        }
+
+        std::vector<char> blob;
+        if (!compile_mesh(obj_path, key, blob) || !write_mesh_file(cache_path.c_str(), blob)) {
+            fprintf(stderr, "%s: could not compile to %s\n", obj_path, cache_path.c_str());
+            failed++;
+            continue;
+        }
+        const mesh_file_header * header = (const mesh_file_header *)blob.data();
+        printf("Wrote %s (%u bytes): %u -> %u vertices, %u triangles, ACMR %.3f welded -> %.3f optimized\n", cache_path.c_str(),
+               (unsigned)blob.size(), header->stats.source_vertex_count, header->vertex_count, header->lods[0].index_count / 3,
+               header->stats.welded_acmr, header->stats.optimized_acmr);
+        for (uint32_t l = 1; l < header->lod_count; l++) {
+            printf("  LOD %u: %u triangles, error %.4f\n", l, header->lods[l].index_count / 3, header->lods[l].error);
+        }
+    }
+    return failed ? 1 : 0;
+}
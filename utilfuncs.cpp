@@ -1,152 +1,811 @@
 // OpenConsole - utility functions
 
-void load_model(const char * filename, GLuint obj) {
+// Create the shared vertex, index and instance buffers and the vertex arrays reading them
+void build_shared_buffers() {
+    glGenBuffers(NumSharedBuffers, SharedBuffers);
+    vertex_arena.grow(InitialArenaVertices);
+    index_arena.grow(InitialArenaIndices);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, SharedBuffers[VertexBuffer]);
+    glBufferData(GL_COPY_WRITE_BUFFER, (GLsizeiptr)modelLayout.stride * vertex_arena.capacity(), NULL, GL_STATIC_DRAW);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, SharedBuffers[IndexBuffer]);
+    glBufferData(GL_COPY_WRITE_BUFFER, sizeof(GLuint) * index_arena.capacity(), NULL, GL_STATIC_DRAW);
+
+    glGenVertexArrays(1, &model_vao);
+    glsBindVertexArray(model_vao);
+
+    // Packed vertex attributes for default shader (set once, kept in the vertex array)
+    glsBindBuffer(GL_ARRAY_BUFFER, SharedBuffers[VertexBuffer]);
+    glVertexAttribPointer(default_vPos, 3, GL_UNSIGNED_SHORT, GL_TRUE, modelLayout.stride, BUFFER_OFFSET((size_t)modelLayout.offsets[MeshPosition]));
+    glEnableVertexAttribArray(default_vPos);
+    if (modelLayout.attributes & VertexNormal) {
+        glVertexAttribPointer(default_vNormal, 2, GL_SHORT, GL_TRUE, modelLayout.stride, BUFFER_OFFSET((size_t)modelLayout.offsets[MeshNormal]));
+        glEnableVertexAttribArray(default_vNormal);
+    }
+    if (modelLayout.attributes & VertexTexCoord) {
+        glVertexAttribPointer(default_vTexCoord, 2, GL_HALF_FLOAT, GL_FALSE, modelLayout.stride, BUFFER_OFFSET((size_t)modelLayout.offsets[MeshTexCoord]));
+        glEnableVertexAttribArray(default_vTexCoord);
+    }
+
+    // Index buffer (kept in the vertex array)
+    glsBindBuffer(GL_ELEMENT_ARRAY_BUFFER, SharedBuffers[IndexBuffer]);
+
+    // Per-instance attributes for default shader. Draws pass the first instance of their batch where the context
+    // allows it; otherwise the attributes are pointed at each batch's instances when it is drawn.
+    base_instance_draws = GLEW_VERSION_4_2 || GLEW_ARB_base_instance;
+    glsBindBuffer(GL_ARRAY_BUFFER, SharedBuffers[InstBuffer]);
+    set_instance_attributes();
+    glsBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    // The GPU culling path reads the same vertices, and the index of each instance's object from the visible list
+    if (gpu_culling) {
+        glGenVertexArrays(1, &indirect_vao);
+        glsBindVertexArray(indirect_vao);
+        glsBindBuffer(GL_ARRAY_BUFFER, SharedBuffers[VertexBuffer]);
+        glVertexAttribPointer(indirect_vPos, 3, GL_UNSIGNED_SHORT, GL_TRUE, modelLayout.stride, BUFFER_OFFSET((size_t)modelLayout.offsets[MeshPosition]));
+        glEnableVertexAttribArray(indirect_vPos);
+        glsBindBuffer(GL_ELEMENT_ARRAY_BUFFER, SharedBuffers[IndexBuffer]);
+        glsBindBuffer(GL_ARRAY_BUFFER, GpuBuffers[VisibleBuffer]);
+        glVertexAttribIPointer(indirect_vObject, 1, GL_UNSIGNED_INT, 0, NULL);
+        glVertexAttribDivisor(indirect_vObject, 1);
+        glEnableVertexAttribArray(indirect_vObject);
+        glsBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+}
+
+// Reset a new mesh. Its vertex data is allocated and uploaded once the mesh is generated.
+void build_model_buffers(model_mesh& mesh) {
+    mesh.num_vertices = 0;
+    mesh.num_indices = 0;
+    mesh.bounds = aabb::empty();
+    mesh.bounds.expand(vec3(0.0f, 0.0f, 0.0f));
+}
+
+// Take count units (vertices or indices) of unit_size bytes from a shared buffer and return the first. When the
+// buffer is full it is grown to at least twice its size, copying its contents through a temporary buffer; it keeps
+// its name, so the vertex arrays reading it stay valid.
+GLuint allocate_shared(SharedBuffer_IDs buffer, range_allocator& arena, GLsizeiptr unit_size, GLuint count) {
+    GLuint first = 0;
+    if (arena.allocate(count, first)) {
+        return first;
+    }
+
+    GLsizeiptr old_size = unit_size * arena.capacity();
+    arena.grow(arena.capacity() + std::max(arena.capacity(), count));
+    arena.allocate(count, first);
+
+    GLuint copy;
+    glGenBuffers(1, &copy);
+    glBindBuffer(GL_COPY_READ_BUFFER, SharedBuffers[buffer]);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, copy);
+    glBufferData(GL_COPY_WRITE_BUFFER, old_size, NULL, GL_STREAM_COPY);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, old_size);
+    glBufferData(GL_COPY_READ_BUFFER, unit_size * arena.capacity(), NULL, GL_STATIC_DRAW);
+    glCopyBufferSubData(GL_COPY_WRITE_BUFFER, GL_COPY_READ_BUFFER, 0, 0, old_size);
+    glDeleteBuffers(1, &copy);
+    return first;
+}
+
+// Register an empty mesh under a key. Returns the mesh id.
+GLuint register_mesh(const string& key) {
+    GLuint id = (GLuint)meshes.size();
+    meshes.push_back(model_mesh());
+    MeshNames.push_back(key);
+    MeshLibrary[key] = id;
+
+    build_model_buffers(meshes[id]);
+    return id;
+}
+
+// Register the mesh of a canonical key and start a loader thread generating it. Returns the mesh id.
+GLuint create_mesh(const string& key, primitive_shape shape, const primitive_parameters& parameters) {
+    GLuint id = register_mesh(key);
+    model_loaders[id] = thread(load_model, id, shape, parameters);
+    models_pending++;
+    return id;
+}
+
+// Register the mesh of an OBJ file and start a loader thread reading it. Returns the mesh id.
+GLuint create_file_mesh(const string& path) {
+    GLuint id = register_mesh(path);
+    model_loaders[id] = thread(load_model_file, id, path);
+    models_pending++;
+    return id;
+}
+
+// Runs on a loader thread: generates the mesh, optimizes it like a compiled OBJ and queues it for upload by the
+// main loop
+void load_model(GLuint mesh_id, primitive_shape shape, primitive_parameters parameters) {
+    double start_time = glfwGetTime();
+
     vector<vec4> vertices;
-    vector<vec2> uvCoords;
+    vector<vec2> uvs;
     vector<vec3> normals;
+    vector<uint32_t> indices;
+    generate_primitive(shape, parameters, vertices, uvs, normals, indices);
 
-    // Load model and set number of vertices
-    loadOBJ(filename, vertices, uvCoords, normals);
-    numVertices[obj] = vertices.size();
+    // Generated meshes have no source file, and each triangle corner counts as a vertex before indexing
+    vector<char> blob;
+    mesh_source_key no_source = {0, 0};
+    build_mesh_file(vertices, uvs, normals, indices, no_source, (uint32_t)indices.size(), blob);
 
-    // Create and load object buffers
-    glGenBuffers(NumObjBuffers, ObjBuffers[obj]);
-    glBindVertexArray(VAOs[obj]);
-    glBindBuffer(GL_ARRAY_BUFFER, ObjBuffers[obj][PosBuffer]);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat)*posCoords*numVertices[obj], vertices.data(), GL_STATIC_DRAW);
-    glBindBuffer(GL_ARRAY_BUFFER, ObjBuffers[obj][NormBuffer]);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat)*normCoords*numVertices[obj], normals.data(), GL_STATIC_DRAW);
-    glBindBuffer(GL_ARRAY_BUFFER, ObjBuffers[obj][TexBuffer]);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat)*texCoords*numVertices[obj], uvCoords.data(), GL_STATIC_DRAW);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    unique_ptr<mesh_cache> mesh(new mesh_cache);
+    if (!mesh->assign(blob)) {
+        mesh.reset();
+    }
+    queue_loaded_model(mesh_id, std::move(mesh), start_time);
 }
 
-// Create solid color buffer
-void build_solid_color_buffer(GLuint num_vertices, vec4 color, GLuint buffer) {
-    vector<vec4> obj_colors;
-    for (int i = 0; i < num_vertices; i++) {
-        obj_colors.push_back(color);
+// Runs on a loader thread: maps the compiled cache of an OBJ file (compiling it first if it is missing or out of
+// date, see meshc) and queues the mesh for upload by the main loop
+void load_model_file(GLuint mesh_id, string path) {
+    double start_time = glfwGetTime();
+
+    unique_ptr<mesh_cache> mesh(new mesh_cache);
+    if (!mesh->load(path.c_str())) {
+        mesh.reset();
     }
+    queue_loaded_model(mesh_id, std::move(mesh), start_time);
+}
 
-    glBindBuffer(GL_ARRAY_BUFFER, ColorBuffers[buffer]);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat)*colCoords*num_vertices, obj_colors.data(), GL_STATIC_DRAW);
+// Packs the vertices of a loaded mesh (null if it failed) and queues it for upload by the main loop
+void queue_loaded_model(GLuint mesh_id, unique_ptr<mesh_cache> mesh, double start_time) {
+    loaded_model model;
+    model.mesh_id = mesh_id;
+    model.mesh = std::move(mesh);
+    if (model.mesh) {
+        pack_vertices(*model.mesh, modelLayout, model.vertices);
+    }
+    model.load_ms = (glfwGetTime() - start_time) * 1000.0;
+
+    loaded_models.push(std::move(model));
+    request_redraw();
 }
 
-// Draw object with color
-void draw_color_obj(GLuint obj, GLuint color) {
+// Upload the meshes that finished generating since the last call
+void upload_loaded_models() {
+    if (loaded_models.empty()) {
+        return;
+    }
 
-    // Select default shader program
-    glUseProgram(default_program);
+    loaded_batch.clear();
+    loaded_models.drain(loaded_batch);
+    for (const loaded_model& model : loaded_batch) {
+        upload_model(model);
+        models_pending--;
+        if (model.mesh_id < startup_meshes && --startup_models_pending == 0) {
+            report_models_loaded();
+        }
 
-    // Pass projection matrix to default shader
-    glUniformMatrix4fv(default_proj_mat_loc, 1, GL_FALSE, proj_matrix);
+        // The loader finishes right after queueing its mesh
+        auto loader = model_loaders.find(model.mesh_id);
+        loader->second.join();
+        model_loaders.erase(loader);
+    }
+    loaded_batch.clear();
+}
 
-    // Pass camera matrix to default shader
-    glUniformMatrix4fv(default_cam_mat_loc, 1, GL_FALSE, camera_matrix);
+// Records and prints when the meshes of the scene restored at startup were all uploaded
+void report_models_loaded() {
+    models_loaded_ms = glfwGetTime() * 1000.0;
+    printf("Scene meshes generated %.1f ms after startup\n", models_loaded_ms);
+}
 
-    // Pass model matrix to default shader
-    glUniformMatrix4fv(default_model_mat_loc, 1, GL_FALSE, model_matrix);
+// Copy a generated mesh into its buffers and rebuild the bounds of the objects already using it
+void upload_model(const loaded_model& model) {
+    model_mesh& mesh = meshes[model.mesh_id];
+    if (!model.mesh) {
+        cerr << "Could not generate mesh " << MeshNames[model.mesh_id] << endl;
+        return;
+    }
+    const mesh_cache& data = *model.mesh;
+
+    // Set number of vertices and indices, bounds and statistics
+    mesh.num_vertices = data.vertex_count();
+    mesh.num_indices = data.index_count();
+    mesh.stats = data.stats();
+    mesh.quantization = quantize_bounds(data.bounds_min(), data.bounds_max());
+    mesh.bounds = aabb::empty();
+    mesh.bounds.expand(vec3(data.bounds_min()[0], data.bounds_min()[1], data.bounds_min()[2]));
+    mesh.bounds.expand(vec3(data.bounds_max()[0], data.bounds_max()[1], data.bounds_max()[2]));
+    mesh.radius = length(mesh.bounds.extents());
+    mesh.lods.clear();
+    for (uint32_t level = 0; level < data.lod_count(); level++) {
+        mesh.lods.push_back(data.lod(level));
+    }
 
-    // Bind vertex array
-    glBindVertexArray(VAOs[obj]);
+    // Load the packed vertices and the indices into ranges of the shared buffers
+    mesh.base_vertex = allocate_shared(VertexBuffer, vertex_arena, modelLayout.stride, mesh.num_vertices);
+    mesh.first_index = allocate_shared(IndexBuffer, index_arena, sizeof(GLuint), mesh.num_indices);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, SharedBuffers[VertexBuffer]);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, (GLintptr)modelLayout.stride * mesh.base_vertex, model.vertices.size(), model.vertices.data());
+    glBindBuffer(GL_COPY_WRITE_BUFFER, SharedBuffers[IndexBuffer]);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, sizeof(GLuint) * mesh.first_index, sizeof(GLuint) * mesh.num_indices, data.indices());
+
+    printf("Generated %s (%u triangles, %u levels of detail) in %.2f ms\n", MeshNames[model.mesh_id].c_str(),
+           mesh.lods[0].index_count / 3, (unsigned)mesh.lods.size(), model.load_ms);
+
+    // Objects using this mesh were placed with point bounds, a zeroed revision makes the render cache rebuild them
+    size_t count = std::min(objects.size(), scene_cache.revisions.size());
+    for (size_t i = 0; i < count; i++) {
+        if (objects.shapes[i] == model.mesh_id) {
+            scene_cache.revisions[i] = 0;
+            render_cache_stale = true;
+        }
+    }
+}
 
-    // Bind position object buffer and set attributes for default shader
-    glBindBuffer(GL_ARRAY_BUFFER, ObjBuffers[obj][PosBuffer]);
-    glVertexAttribPointer(default_vPos, posCoords, GL_FLOAT, GL_FALSE, 0, NULL);
-    glEnableVertexAttribArray(default_vPos);
+// Fill the color palette with the predefined named colors
+void build_color_palette() {
+    for (const auto& color : colorMap) {
+        const vector<float>& colorVec = color.second;
+        ColorLibrary[color.first] = ColorPalette.size();
+        ColorPalette.push_back(vec4(colorVec[0], colorVec[1], colorVec[2], 1.0f));
+        ColorNames.push_back(color.first);
+    }
+}
+
+// Set up the per-instance attributes of the bound vertex array from the start of the bound instance buffer
+void set_instance_attributes() {
+    point_instance_attributes(0);
+
+    // The affine model transform is passed as three vec4 rows in consecutive locations
+    for (GLuint row = 0; row < 3; row++) {
+        glVertexAttribDivisor(default_vModel + row, 1);
+        glEnableVertexAttribArray(default_vModel + row);
+    }
 
-    // Bind color buffer and set attributes for default shader
-    glBindBuffer(GL_ARRAY_BUFFER, ColorBuffers[color]);
-    glVertexAttribPointer(default_vCol, colCoords, GL_FLOAT, GL_FALSE, 0, NULL);
+    // Color (RGBA8)
+    glVertexAttribDivisor(default_vCol, 1);
     glEnableVertexAttribArray(default_vCol);
+}
+
+// Point the per-instance attributes of the bound vertex array at the bound instance buffer, starting at an instance
+void point_instance_attributes(GLuint first_instance) {
+    size_t first = sizeof(instance) * first_instance;
 
-    // Draw object
-    glDrawArrays(GL_TRIANGLES, 0, numVertices[obj]);
+    for (GLuint row = 0; row < 3; row++) {
+        glVertexAttribPointer(default_vModel + row, posCoords, GL_FLOAT, GL_FALSE, sizeof(instance), BUFFER_OFFSET(first + sizeof(vec4)*row));
+    }
+    glVertexAttribPointer(default_vCol, colCoords, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(instance), BUFFER_OFFSET(first + sizeof(affine)));
 }
 
-void framebuffer_size_callback(GLFWwindow *window, int width, int height) {
-    glViewport(0, 0, width, height);
+// Upload the instances of the axes and of every mesh and level to the shared instance buffer (orphaning the previous
+// storage), noting where each list starts
+void upload_frame_instances() {
+    frame_instances.clear();
+    for (size_t m = 0; m <= meshes.size(); m++) {
+        model_mesh& mesh = m == 0 ? axes_mesh : meshes[m - 1];
+        for (GLuint level = 0; level < MeshMaxLods; level++) {
+            mesh.first_instance[level] = (GLuint)frame_instances.size();
+            frame_instances.insert(frame_instances.end(), mesh.instances[level].begin(), mesh.instances[level].end());
+        }
+    }
+    glsBindBuffer(GL_ARRAY_BUFFER, SharedBuffers[InstBuffer]);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(instance)*frame_instances.size(), frame_instances.data(), GL_STREAM_DRAW);
+}
 
-    ww = width;
-    hh = height;
+// Draw the instances of a mesh at one level of detail with per-instance model transforms and colors
+void draw_instanced_obj(model_mesh& mesh, GLuint level, GLenum mode) {
+    GLsizei count = (GLsizei)mesh.instances[level].size();
+
+    // Select default shader program (matrices come from the per-frame uniform buffer)
+    glsUseProgram(default_program);
+
+    // Bind the shared vertex array, and without base instance draws point its instance attributes at this batch
+    GLuint first_instance = mesh.first_instance[level];
+    glsBindVertexArray(model_vao);
+    if (!base_instance_draws) {
+        glsBindBuffer(GL_ARRAY_BUFFER, SharedBuffers[InstBuffer]);
+        point_instance_attributes(first_instance);
+    }
+
+    // Position dequantization of this mesh
+    glUniform3fv(default_mesh_offset, 1, mesh.quantization.offset);
+    glUniform3fv(default_mesh_scale, 1, mesh.quantization.scale);
+
+    // Draw all instances from the mesh's ranges of the shared buffers (meshes are indexed, the axes are not)
+    if (level < mesh.lods.size()) {
+        const mesh_file_lod& lod = mesh.lods[level];
+        const GLvoid* indices = BUFFER_OFFSET(sizeof(GLuint) * (mesh.first_index + lod.index_offset));
+        if (base_instance_draws) {
+            glDrawElementsInstancedBaseVertexBaseInstance(mode, lod.index_count, GL_UNSIGNED_INT, indices, count, mesh.base_vertex, first_instance);
+        } else {
+            glDrawElementsInstancedBaseVertex(mode, lod.index_count, GL_UNSIGNED_INT, indices, count, mesh.base_vertex);
+        }
+    } else if (base_instance_draws) {
+        glDrawArraysInstancedBaseInstance(mode, mesh.base_vertex, mesh.num_vertices, count, first_instance);
+    } else {
+        glDrawArraysInstanced(mode, mesh.base_vertex, mesh.num_vertices, count);
+    }
 }
 
-void build_axes() {
-    vector<vec4> vertices;
-    vector<ivec3> indices;
-    vector<vec4> colors;
-
-    // Bind target vertex array object
-    glBindVertexArray(VAOs[Axes]);
-
-    // Define vertices for axes
-    vertices = {
-            {0.0, 0.0f, 0.0f, 1.0f},
-            {axis_length, 0.0f, 0.0f, 1.0f},  // x-axis
-            {0.0f, 0.0f, 0.0f, 1.0f},
-            {0.0f, axis_length, 0.0f, 1.0f}, // y-axis
-            {0.0f, 0.0f, 0.0f, 1.0f},
-            {0.0f, 0.0f, axis_length, 1.0f}, // z-axis
-    };
-
-    // Define axis colors (red - x, green - y, blue - z)
-    colors.push_back(vec4(1.0f, 0.0f, 0.0f, 1.0f));
-    colors.push_back(vec4(1.0f, 0.0f, 0.0f, 1.0f));
-    colors.push_back(vec4(0.0f, 1.0f, 0.0f, 1.0f));
-    colors.push_back(vec4(0.0f, 1.0f, 0.0f, 1.0f));
-    colors.push_back(vec4(0.0f, 0.0f, 1.0f, 1.0f));
-    colors.push_back(vec4(0.0f, 0.0f, 1.0f, 1.0f));
+// Set up GPU culling: needs GL 4.3 with storage buffers in vertex shaders, and both programs to build. Returns false
+// (leaving the CPU path in use) otherwise. Occlusion culling is turned on as well if its program builds.
+bool build_gpu_culling() {
+    if (!GLEW_VERSION_4_3) {
+        return false;
+    }
+    GLint vertex_storage_blocks = 0;
+    glGetIntegerv(GL_MAX_VERTEX_SHADER_STORAGE_BLOCKS, &vertex_storage_blocks);
+    if (vertex_storage_blocks < 4) {
+        return false;
+    }
 
-    // Set numVertices
-    numVertices[Axes] = 6;
+    ShaderInfo cull_shaders[] = { {GL_COMPUTE_SHADER, cull_compute_shader},{GL_NONE, NULL} };
+    cull_program = LoadShaders(cull_shaders);
+    ShaderInfo indirect_shaders[] = { {GL_VERTEX_SHADER, indirect_vertex_shader},{GL_FRAGMENT_SHADER, default_frag_shader},{GL_NONE, NULL} };
+    indirect_program = LoadShaders(indirect_shaders);
+    if (!cull_program || !indirect_program) {
+        cerr << "Could not build the GPU culling shaders" << endl;
+        return false;
+    }
+
+    cull_object_count = glGetUniformLocation(cull_program, "object_count");
+    cull_planes = glGetUniformLocation(cull_program, "planes");
+    cull_pixels_per_unit = glGetUniformLocation(cull_program, "pixels_per_unit");
+    cull_lod_error = glGetUniformLocation(cull_program, "lod_error");
+    cull_lod_hysteresis = glGetUniformLocation(cull_program, "lod_hysteresis");
+    cull_phase = glGetUniformLocation(cull_program, "phase");
+    cull_phase_commands = glGetUniformLocation(cull_program, "phase_commands");
+    cull_occlusion = glGetUniformLocation(cull_program, "occlusion");
+    cull_depth_pyramid = glGetUniformLocation(cull_program, "depth_pyramid");
+    glUniformBlockBinding(cull_program, glGetUniformBlockIndex(cull_program, "FrameData"), FrameDataBinding);
+
+    indirect_vPos = glGetAttribLocation(indirect_program, "vPosition");
+    indirect_vObject = glGetAttribLocation(indirect_program, "vObject");
+    glUniformBlockBinding(indirect_program, glGetUniformBlockIndex(indirect_program, "FrameData"), FrameDataBinding);
+
+    glGenBuffers(NumGpuBuffers, GpuBuffers);
+    for (GLuint buffer = 0; buffer < NumGpuBuffers; buffer++) {
+        glsBindBuffer(GL_SHADER_STORAGE_BUFFER, GpuBuffers[buffer]);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, 16, NULL, GL_DYNAMIC_DRAW);
+    }
+
+    if (!occlusion_culling_disabled) {
+        ShaderInfo pyramid_shaders[] = { {GL_COMPUTE_SHADER, depth_pyramid_shader},{GL_NONE, NULL} };
+        pyramid_program = LoadShaders(pyramid_shaders);
+        if (pyramid_program) {
+            pyramid_source = glGetUniformLocation(pyramid_program, "source");
+            pyramid_source_level = glGetUniformLocation(pyramid_program, "source_level");
+            pyramid_destination = glGetUniformLocation(pyramid_program, "destination");
+            glGenTextures(1, &depth_texture);
+            glGenTextures(1, &depth_pyramid);
+            occlusion_culling = true;
+        } else {
+            cerr << "Could not build the depth pyramid shader, drawing without occlusion culling" << endl;
+        }
+    }
+    return true;
+}
+
+// Bring the object buffers up to date with the scene: transforms and bounds of the objects that changed this frame
+// (of all of them after adds or deletes), and the mesh and color of every object whenever the scene changed
+void update_gpu_objects() {
+    size_t count = objects.size();
+
+    // New object indices: reallocate, and reset the state kept per object
+    bool all_changed = scene_cache.structure_version != gpu_structure_version;
+    if (all_changed) {
+        gpu_structure_version = scene_cache.structure_version;
+        gpu_transforms.resize(count);
+        if (count > gpu_object_capacity) {
+            gpu_object_capacity = std::max(count, gpu_object_capacity * 3 / 2);
+            glsBindBuffer(GL_SHADER_STORAGE_BUFFER, GpuBuffers[TransformBuffer]);
+            glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(gpu_transform) * gpu_object_capacity, NULL, GL_DYNAMIC_DRAW);
+            glsBindBuffer(GL_SHADER_STORAGE_BUFFER, GpuBuffers[ObjectInfoBuffer]);
+            glBufferData(GL_SHADER_STORAGE_BUFFER, 2 * sizeof(GLuint) * gpu_object_capacity, NULL, GL_DYNAMIC_DRAW);
+            glsBindBuffer(GL_SHADER_STORAGE_BUFFER, GpuBuffers[LodStateBuffer]);
+            glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint) * gpu_object_capacity, NULL, GL_DYNAMIC_DRAW);
+            glsBindBuffer(GL_SHADER_STORAGE_BUFFER, GpuBuffers[VisibilityBuffer]);
+            glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint) * gpu_object_capacity, NULL, GL_DYNAMIC_DRAW);
+        }
 
-    // Generate object buffer for table
-    glGenBuffers(NumObjBuffers, ObjBuffers[Axes]);
+        // Every object starts at full detail and as not seen, so none is drawn before the occlusion test
+        vector<GLuint> zeros(count, 0);
+        glsBindBuffer(GL_SHADER_STORAGE_BUFFER, GpuBuffers[LodStateBuffer]);
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(GLuint) * count, zeros.data());
+        glsBindBuffer(GL_SHADER_STORAGE_BUFFER, GpuBuffers[VisibilityBuffer]);
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(GLuint) * count, zeros.data());
+    }
 
-    // Bind axes positions
-    glBindBuffer(GL_ARRAY_BUFFER, ObjBuffers[Axes][PosBuffer]);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat)*posCoords*numVertices[Axes], vertices.data(), GL_STATIC_DRAW);
+    // Transforms, uploaded as the one range spanning the changed objects
+    size_t first = all_changed ? 0 : count;
+    size_t last = all_changed ? count : 0;
+    for (size_t n = 0; n < (all_changed ? count : changed_objects.size()); n++) {
+        size_t i = all_changed ? n : changed_objects[n];
+        const vec3& scale = objects.scales[i];
+        float max_scale = std::max(fabsf(scale[0]), std::max(fabsf(scale[1]), fabsf(scale[2])));
+        vec3 center = scene_cache.bounds[i].center();
+        vec3 extents = scene_cache.bounds[i].extents();
+
+        gpu_transform& transform = gpu_transforms[i];
+        transform.model = scene_cache.models[i];
+        transform.center = vec4(center[0], center[1], center[2], meshes[objects.shapes[i]].radius * max_scale);
+        transform.extents = vec4(extents[0], extents[1], extents[2], 0.0f);
+        first = std::min(first, i);
+        last = std::max(last, i + 1);
+    }
+    if (first < last) {
+        glsBindBuffer(GL_SHADER_STORAGE_BUFFER, GpuBuffers[TransformBuffer]);
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, sizeof(gpu_transform) * first, sizeof(gpu_transform) * (last - first), &gpu_transforms[first]);
+    }
 
-    // Bind axes colors
-    glBindBuffer(GL_ARRAY_BUFFER, ColorBuffers[AxesColor]);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat)*colCoords*numVertices[Axes], colors.data(), GL_STATIC_DRAW);
+    // Meshes and colors (which changes do not stamp a new revision on), the palette and the objects per mesh
+    if (scene_cache.objects_changed) {
+        scene_cache.objects_changed = false;
+        gpu_object_info.resize(2 * count);
+        gpu_mesh_objects.assign(meshes.size(), 0);
+        for (size_t i = 0; i < count; i++) {
+            gpu_object_info[2 * i] = objects.shapes[i];
+            gpu_object_info[2 * i + 1] = objects.colors[i];
+            gpu_mesh_objects[objects.shapes[i]]++;
+        }
+        if (count > 0) {
+            glsBindBuffer(GL_SHADER_STORAGE_BUFFER, GpuBuffers[ObjectInfoBuffer]);
+            glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(GLuint) * gpu_object_info.size(), gpu_object_info.data());
+        }
+        glsBindBuffer(GL_SHADER_STORAGE_BUFFER, GpuBuffers[PaletteBuffer]);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(vec4) * ColorPalette.size(), ColorPalette.data(), GL_DYNAMIC_DRAW);
+    }
 }
 
-void draw_axes(){
-    model_matrix = mat4().identity();
+///////////////////////////////////////////////////////////////////////
+/// Function: render_scene_gpu()                                    ///
+/// Description: GPU-driven version of render_scene(). Resets one   ///
+/// indirect draw command per mesh and level of detail, runs the    ///
+/// culling compute shader over all objects to fill them in, then   ///
+/// draws them all with a single multi-draw indirect call. With     ///
+/// occlusion culling this is done twice: for the objects visible   ///
+/// last frame, then for the rest against their depth.              ///
+/// Parameters:                                                     ///
+///     N/A                                                         ///
+/// Return Value:                                                   ///
+///     N/A                                                         ///
+///////////////////////////////////////////////////////////////////////
+
+void render_scene_gpu() {
+    update_gpu_objects();
+    GLuint object_count = (GLuint)objects.size();
+
+    // Mesh table and empty commands of each phase. Each mesh gets room in the visible list for all its objects at
+    // every level, in both phases.
+    gpu_mesh_objects.resize(meshes.size(), 0);
+    gpu_mesh_table.assign(meshes.size(), gpu_mesh());
+    gpu_phase_commands = meshes.size() * MeshMaxLods;
+    gpu_commands.assign(NumCullPhases * gpu_phase_commands, draw_elements_command());
+    GLuint visible_size = 0;
+    for (GLuint phase = 0; phase < NumCullPhases; phase++) {
+        for (size_t m = 0; m < meshes.size(); m++) {
+            const model_mesh& mesh = meshes[m];
+            gpu_mesh& entry = gpu_mesh_table[m];
+            entry.lod_count = (GLuint)mesh.lods.size();
+            entry.first_command = (GLuint)(m * MeshMaxLods);
+            for (int c = 0; c < 3; c++) {
+                entry.offset[c] = mesh.quantization.offset[c];
+                entry.scale[c] = mesh.quantization.scale[c];
+            }
+            for (size_t level = 0; level < mesh.lods.size(); level++) {
+                entry.errors[level] = mesh.lods[level].error;
+
+                draw_elements_command& command = gpu_commands[phase * gpu_phase_commands + m * MeshMaxLods + level];
+                command.count = mesh.lods[level].index_count;
+                command.first_index = mesh.first_index + mesh.lods[level].index_offset;
+                command.base_vertex = (GLint)mesh.base_vertex;
+                command.base_instance = visible_size;
+                visible_size += gpu_mesh_objects[m];
+            }
+        }
+    }
 
-    // Select default shader program
-    glUseProgram(default_program);
+    glsBindBuffer(GL_SHADER_STORAGE_BUFFER, GpuBuffers[MeshTableBuffer]);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(gpu_mesh) * gpu_mesh_table.size(), gpu_mesh_table.data(), GL_STREAM_DRAW);
+    glsBindBuffer(GL_SHADER_STORAGE_BUFFER, GpuBuffers[CommandBuffer]);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(draw_elements_command) * gpu_commands.size(), gpu_commands.data(), GL_STREAM_DRAW);
+    if (visible_size > gpu_visible_capacity) {
+        gpu_visible_capacity = std::max((size_t)visible_size, gpu_visible_capacity * 3 / 2);
+        glsBindBuffer(GL_SHADER_STORAGE_BUFFER, GpuBuffers[VisibleBuffer]);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint) * gpu_visible_capacity, NULL, GL_DYNAMIC_DRAW);
+    }
+    const GLuint no_objects_occluded = 0;
+    glsBindBuffer(GL_SHADER_STORAGE_BUFFER, GpuBuffers[OcclusionStatsBuffer]);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(GLuint), &no_objects_occluded);
+    for (GLuint buffer = 0; buffer < NumGpuBuffers; buffer++) {
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, buffer, GpuBuffers[buffer]);
+    }
+    if (object_count == 0) {
+        return;
+    }
 
-    // Pass projection matrix to default shader
-    glUniformMatrix4fv(default_proj_mat_loc, 1, GL_FALSE, proj_matrix);
+    // Cull and pick levels of detail, one invocation per object
+    view_frustum frustum = view_frustum::from_matrix(proj_matrix * camera_matrix);
+    GLfloat planes[6][4];
+    for (int p = 0; p < 6; p++) {
+        planes[p][0] = frustum.a[p];
+        planes[p][1] = frustum.b[p];
+        planes[p][2] = frustum.c[p];
+        planes[p][3] = frustum.d[p];
+    }
 
-    // Pass camera matrix to default shader
-    glUniformMatrix4fv(default_cam_mat_loc, 1, GL_FALSE, camera_matrix);
+    bool occlusion = occlusion_culling && ww > 0 && hh > 0;
+    glsUseProgram(cull_program);
+    glUniform1ui(cull_object_count, object_count);
+    glUniform4fv(cull_planes, 6, &planes[0][0]);
+    glUniform1f(cull_pixels_per_unit, 0.5f * hh * proj_matrix[1][1]);
+    glUniform1f(cull_lod_error, lod_pixel_error);
+    glUniform1f(cull_lod_hysteresis, LodHysteresis);
+    glUniform1ui(cull_phase_commands, (GLuint)gpu_phase_commands);
+    glUniform1i(cull_occlusion, occlusion);
+    glUniform1i(cull_depth_pyramid, 0);
+
+    // Objects visible last frame, then the depth pyramid of what they covered
+    if (occlusion) {
+        glUniform1ui(cull_phase, CullVisibleLastFrame);
+        glDispatchCompute((object_count + 63) / 64, 1, 1);
+        glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+        draw_gpu_commands(CullVisibleLastFrame);
+
+        build_depth_pyramid();
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, depth_pyramid);
+        glsUseProgram(cull_program);
+    }
 
-    // Pass model matrix to default shader
-    glUniformMatrix4fv(default_model_mat_loc, 1, GL_FALSE, model_matrix);
+    // Everything else that is in view and not hidden
+    glUniform1ui(cull_phase, CullRemaining);
+    glDispatchCompute((object_count + 63) / 64, 1, 1);
+    glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT |
+                    GL_BUFFER_UPDATE_BARRIER_BIT);
+    draw_gpu_commands(CullRemaining);
+}
 
-    // Bind vertex array
-    glBindVertexArray(VAOs[Axes]);
+// Draw the commands one culling phase filled in, every level of every mesh with one call, as the meshes share their
+// buffers. Commands no object was appended to draw nothing.
+void draw_gpu_commands(GLuint phase) {
+    glsUseProgram(indirect_program);
+    glsBindVertexArray(indirect_vao);
+    glsBindBuffer(GL_DRAW_INDIRECT_BUFFER, GpuBuffers[CommandBuffer]);
+    glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, BUFFER_OFFSET(sizeof(draw_elements_command) * phase * gpu_phase_commands),
+                                (GLsizei)gpu_phase_commands, sizeof(draw_elements_command));
+}
 
-    // Bind position object buffer and set attributes for default shader
-    glBindBuffer(GL_ARRAY_BUFFER, ObjBuffers[Axes][PosBuffer]);
-    glVertexAttribPointer(default_vPos, posCoords, GL_FLOAT, GL_FALSE, 0, NULL);
-    glEnableVertexAttribArray(default_vPos);
+// Copy the window's depth and reduce it into the depth pyramid, remaking both textures when the window was resized.
+// Level 0 of the pyramid is half the window rounded up to powers of two, so each level halves the one below exactly.
+void build_depth_pyramid() {
+    glActiveTexture(GL_TEXTURE0);
+    if (ww != depth_width || hh != depth_height) {
+        depth_width = ww;
+        depth_height = hh;
+        pyramid_width = 1;
+        while (pyramid_width * 2 < ww) {
+            pyramid_width *= 2;
+        }
+        pyramid_height = 1;
+        while (pyramid_height * 2 < hh) {
+            pyramid_height *= 2;
+        }
+        pyramid_levels = 1;
+        while ((std::max(pyramid_width, pyramid_height) >> (pyramid_levels - 1)) > 1) {
+            pyramid_levels++;
+        }
 
-    // Bind color buffer and set attributes for default shader
-    glBindBuffer(GL_ARRAY_BUFFER, ColorBuffers[AxesColor]);
-    glVertexAttribPointer(default_vCol, colCoords, GL_FLOAT, GL_FALSE, 0, NULL);
-    glEnableVertexAttribArray(default_vCol);
+        // Immutable storage cannot be resized, so the textures are replaced
+        glDeleteTextures(1, &depth_texture);
+        glDeleteTextures(1, &depth_pyramid);
+        glGenTextures(1, &depth_texture);
+        glGenTextures(1, &depth_pyramid);
+        glBindTexture(GL_TEXTURE_2D, depth_texture);
+        glTexStorage2D(GL_TEXTURE_2D, 1, GL_DEPTH_COMPONENT32F, ww, hh);
+        glBindTexture(GL_TEXTURE_2D, depth_pyramid);
+        glTexStorage2D(GL_TEXTURE_2D, pyramid_levels, GL_R32F, pyramid_width, pyramid_height);
+    }
 
-    // Draw object
-    glDrawArrays(GL_LINES, 0, 6);
+    glBindTexture(GL_TEXTURE_2D, depth_texture);
+    glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 0, 0, ww, hh);
+
+    glsUseProgram(pyramid_program);
+    glUniform1i(pyramid_source, 0);
+    glUniform1i(pyramid_destination, 0);
+    for (GLint level = 0; level < pyramid_levels; level++) {
+        GLint width = std::max(pyramid_width >> level, 1);
+        GLint height = std::max(pyramid_height >> level, 1);
+        glBindTexture(GL_TEXTURE_2D, level == 0 ? depth_texture : depth_pyramid);
+        glUniform1i(pyramid_source_level, level == 0 ? 0 : level - 1);
+        glBindImageTexture(0, depth_pyramid, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+        glDispatchCompute((width + 7) / 8, (height + 7) / 8, 1);
+        glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+    }
 }
 
-void print_failed_command() {
-    cin.clear(); // Clear the error state
-    cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n'); // Discard invalid input
+// Reads back the draw commands of the last frame for the 'stats' command (waits for the GPU)
+void read_gpu_culling_stats() {
+    vector<draw_elements_command> commands(gpu_commands.size());
+    if (!commands.empty()) {
+        glsBindBuffer(GL_SHADER_STORAGE_BUFFER, GpuBuffers[CommandBuffer]);
+        glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(draw_elements_command) * commands.size(), commands.data());
+    }
+    GLuint occluded = 0;
+    if (occlusion_culling) {
+        glsBindBuffer(GL_SHADER_STORAGE_BUFFER, GpuBuffers[OcclusionStatsBuffer]);
+        glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(GLuint), &occluded);
+    }
+
+    size_t drawn = 0;
+    size_t triangles_drawn = 0;
+    size_t triangles_total = 0;
+    size_t lod_objects[MeshMaxLods] = {};
+    for (size_t slot = 0; slot < commands.size(); slot++) {
+        drawn += commands[slot].instance_count;
+        triangles_drawn += (size_t)commands[slot].instance_count * (commands[slot].count / 3);
+        lod_objects[slot % MeshMaxLods] += commands[slot].instance_count;
+    }
+    for (size_t m = 0; m < meshes.size() && m < gpu_mesh_objects.size(); m++) {
+        if (!meshes[m].lods.empty()) {
+            triangles_total += (size_t)gpu_mesh_objects[m] * (meshes[m].lods[0].index_count / 3);
+        }
+    }
+
+    stats_objects_drawn.store(drawn);
+    stats_objects_total.store(gpu_transforms.size());
+    stats_objects_occluded.store(occluded);
+    stats_bvh_nodes.store(0);
+    stats_triangles_drawn.store(triangles_drawn);
+    stats_triangles_total.store(triangles_total);
+    for (GLuint level = 0; level < MeshMaxLods; level++) {
+        stats_lod_objects[level].store(lod_objects[level]);
+    }
+}
+
+// Coarsest level of detail of a mesh whose error stays within lod_pixel_error on screen, given the mesh's radius in
+// pixels and the level the object was drawn with last frame. Levels get coarser and their errors larger in order.
+GLuint select_lod(const model_mesh& mesh, float pixel_radius, GLuint current) {
+    GLuint level = 0;
+    for (GLuint next = 1; next < mesh.lods.size(); next++) {
+        float limit = next > current ? lod_pixel_error * LodHysteresis : lod_pixel_error;
+        if (mesh.lods[next].error * pixel_radius > limit) {
+            break;
+        }
+        level = next;
+    }
+    return level;
+}
+
+// Create the per-frame uniform buffer and attach it to its binding point
+void build_frame_buffer() {
+    glGenBuffers(1, &FrameUBO);
+    glsBindBuffer(GL_UNIFORM_BUFFER, FrameUBO);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(frame_data), NULL, GL_DYNAMIC_DRAW);
+    glBindBufferBase(GL_UNIFORM_BUFFER, FrameDataBinding, FrameUBO);
+}
+
+// Upload the camera, projection and viewport for this frame
+void update_frame_data() {
+    frame_data frame;
+    frame.view = camera_matrix;
+    frame.proj = proj_matrix;
+    frame.view_proj = proj_matrix * camera_matrix;
+    frame.viewport = vec4((GLfloat)ww, (GLfloat)hh, 1.0f / ww, 1.0f / hh);
+
+    glsBindBuffer(GL_UNIFORM_BUFFER, FrameUBO);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(frame_data), &frame);
+}
+
+// Keep the culling hierarchy in sync with the object bounds: a full rebuild when objects were added or removed
+// (or after many moves, which degrade a refitted tree), otherwise refit only the objects that changed.
+void update_scene_bvh() {
+    if (scene_cache.structure_changed || refits_since_build > scene_cache.bounds.size() / 4) {
+        scene_bvh.build(scene_cache.bounds);
+        scene_cache.structure_changed = false;
+        refits_since_build = 0;
+    } else if (!changed_objects.empty()) {
+        scene_bvh.refit(scene_cache.bounds, changed_objects);
+        refits_since_build += changed_objects.size();
+    }
+}
+
+// Brings the render cache in line with the scene, rebuilding the model matrix and bounds of every object
+// whose revision differs from the cached one (in one pass) and listing them in changed_objects.
+void update_render_cache(const object_store& scene_objects) {
+    size_t count = scene_objects.size();
+
+    // After adds or deletes, entries that shifted to another index no longer match their revision and get rebuilt
+    if (scene_objects.structure_version != scene_cache.structure_version) {
+        scene_cache.models.resize(count);
+        scene_cache.bounds.resize(count);
+        scene_cache.revisions.resize(count, 0);
+        scene_cache.lods.resize(count, 0);
+        scene_cache.structure_version = scene_objects.structure_version;
+        scene_cache.structure_changed = true;
+    }
+    scene_cache.objects_changed = true;
+
+    for (size_t i = 0; i < count; i++) {
+        if (scene_cache.revisions[i] != scene_objects.revisions[i]) {
+            scene_cache.models[i] = compose_trs(scene_objects.positions[i], scene_objects.angles[i], vec3(0.0f, 1.0f, 0.0f), scene_objects.scales[i]);
+            scene_cache.bounds[i] = transform_bounds(scene_cache.models[i], meshes[scene_objects.shapes[i]].bounds);
+            scene_cache.revisions[i] = scene_objects.revisions[i];
+            changed_objects.push_back(i);
+        }
+    }
+}
+
+void framebuffer_size_callback(GLFWwindow *window, int width, int height) {
+    glViewport(0, 0, width, height);
+
+    ww = width;
+    hh = height;
+
+    request_redraw();
+}
+
+void window_refresh_callback(GLFWwindow *window) {
+    request_redraw();
+}
+
+// Marks the frame as out of date and wakes the main loop if it is waiting for events. Safe to call from any thread.
+void request_redraw() {
+    frameDirty.store(true);
+    glfwPostEmptyEvent();
+}
+
+// The axes are a line mesh in the shared buffers, quantized like the models
+void build_axes() {
+    // Vertices of a single axis along x, packed in modelLayout (positions within the axis' bounds, no normal or
+    // texture coordinates)
+    const GLfloat axis_start[3] = {0.0f, 0.0f, 0.0f};
+    const GLfloat axis_end[3] = {axis_length, 0.0f, 0.0f};
+    const GLushort packed_positions[2][4] = {{0, 0, 0, 0}, {65535, 0, 0, 0}};
+    vector<uint8_t> vertices(2 * modelLayout.stride, 0);
+    for (int v = 0; v < 2; v++) {
+        memcpy(&vertices[v * modelLayout.stride + modelLayout.offsets[MeshPosition]], packed_positions[v], sizeof(packed_positions[v]));
+    }
+    axes_mesh.quantization = quantize_bounds(axis_start, axis_end);
+
+    // Set numVertices
+    axes_mesh.num_vertices = 2;
+
+    axes_mesh.base_vertex = allocate_shared(VertexBuffer, vertex_arena, modelLayout.stride, axes_mesh.num_vertices);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, SharedBuffers[VertexBuffer]);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, (GLintptr)modelLayout.stride * axes_mesh.base_vertex, vertices.size(), vertices.data());
+
+    // Each axis is an instance of the x axis rotated into place (red - x, green - y, blue - z)
+    axes_mesh.instances[0].push_back(instance(affine::identity(), vec4(1.0f, 0.0f, 0.0f, 1.0f)));
+    axes_mesh.instances[0].push_back(instance(affine(rotate(90.0f, 0.0f, 0.0f, 1.0f)), vec4(0.0f, 1.0f, 0.0f, 1.0f)));
+    axes_mesh.instances[0].push_back(instance(affine(rotate(-90.0f, 0.0f, 1.0f, 0.0f)), vec4(0.0f, 0.0f, 1.0f, 1.0f)));
+
+    // Axes instances never change; the CPU culling path uploads them again with every frame's instances
+    upload_frame_instances();
+}
+
+void draw_axes(){
+    draw_instanced_obj(axes_mesh, 0, GL_LINES);
+}
+
+// Reads the command-line options: --continuous to redraw every frame, --fps <n> to cap the frame rate.
+void parse_arguments(int argc, char**argv) {
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--continuous") {
+            continuous_mode = true;
+        } else if (arg == "--fps" && i + 1 < argc) {
+            max_fps = atof(argv[++i]);
+        } else if (arg == "--history-mb" && i + 1 < argc) {
+            history_limit = (size_t)(atof(argv[++i]) * 1024 * 1024);
+        } else if (arg == "--lod-error" && i + 1 < argc) {
+            lod_pixel_error = (float)atof(argv[++i]);
+        } else if (arg == "--cpu-culling") {
+            gpu_culling_disabled = true;
+        } else if (arg == "--no-occlusion") {
+            occlusion_culling_disabled = true;
+        } else {
+            cerr << "Unknown option '" << arg << "' (options: --continuous, --fps <n>, --history-mb <n>, --lod-error <pixels>, "
+                 << "--cpu-culling, --no-occlusion)" << endl;
+        }
+    }
+}
+
+void print_failed_command(istream& in) {
+    in.clear(); // Clear the error state
+    in.ignore(std::numeric_limits<std::streamsize>::max(), '\n'); // Discard invalid input
     cout << "Invalid input. Please enter the command in the suggested format.\n";
 }
 
@@ -161,14 +820,149 @@ string lower_string(string str) {
     return str;
 }
 
+// Parses a hex color of the form #rrggbb or #rrggbbaa.
+bool parse_hex_color(const string& hex, vec4& color) {
+    if ((hex.length() != 7 && hex.length() != 9) || hex[0] != '#') {
+        return false;
+    }
+
+    GLfloat channels[4] = {0.0f, 0.0f, 0.0f, 1.0f};
+    for (int i = 1, c = 0; i < hex.length(); i += 2, c++) {
+        if (!isxdigit(hex[i]) || !isxdigit(hex[i + 1])) {
+            return false;
+        }
+        channels[c] = stoi(hex.substr(i, 2), nullptr, 16) / 255.0f;
+    }
+
+    color = vec4(channels[0], channels[1], channels[2], channels[3]);
+    return true;
+}
+
+// Strips the shape suffix from color names saved by older versions (e.g., "blueCube" -> "blue") and lower-cases the rest.
+string normalize_color_name(string colorName) {
+    const string suffixes[] = {"Cube", "Cone", "Torus", "Cylinder", "Sphere"};
+
+    for (const auto& suffix : suffixes) {
+        if (colorName.length() > suffix.length() &&
+            colorName.compare(colorName.length() - suffix.length(), suffix.length(), suffix) == 0) {
+            colorName.erase(colorName.length() - suffix.length());
+            break;
+        }
+    }
+    return lower_string(colorName);
+}
+
+// Returns the palette index of a color name or hex color, adding hex colors to the palette on first use. Returns -1 if unknown.
+int find_color(const string& colorName) {
+    auto entry = ColorLibrary.find(colorName);
+    if (entry != ColorLibrary.end()) {
+        return entry->second;
+    }
+
+    vec4 color;
+    if (!parse_hex_color(colorName, color)) {
+        return -1;
+    }
+
+    ColorLibrary[colorName] = ColorPalette.size();
+    ColorPalette.push_back(color);
+    ColorNames.push_back(colorName);
+    return ColorLibrary[colorName];
+}
+
+// Returns true if a shape name is the path of an OBJ file (e.g., "../models/torus.obj") rather than a built-in shape.
+bool is_model_file(const string& shapeName) {
+    return shapeName.size() > 4 && lower_string(shapeName.substr(shapeName.size() - 4)) == ".obj";
+}
+
+// Returns the mesh id of a shape name, key (e.g., "sphere" or "sphere:segments=24") or OBJ file path, creating the
+// mesh the first time it is used, or -1 if the shape or a parameter is not valid or the file cannot be opened.
+int find_shape(const string& shapeName) {
+    auto found = MeshLibrary.find(shapeName);
+    if (found != MeshLibrary.end()) {
+        return found->second;
+    }
+
+    // OBJ files are keyed by their path as given, which may be case sensitive
+    if (is_model_file(shapeName)) {
+        mesh_source_key source;
+        if (!get_mesh_source_key(shapeName.c_str(), source)) {
+            return -1;
+        }
+        return create_file_mesh(shapeName);
+    }
+
+    string name = lower_string(shapeName);
+    primitive_shape shape;
+    primitive_parameters parameters;
+    if (!parse_primitive_key(name, shape, parameters)) {
+        return -1;
+    }
+
+    // Keys naming the same tessellation differently (e.g., with a default value spelled out) share one mesh
+    string key = primitive_key(shape, parameters);
+    found = MeshLibrary.find(key);
+    if (found != MeshLibrary.end()) {
+        return found->second;
+    }
+    return create_mesh(key, shape, parameters);
+}
+
+// Writes one object as a line of save data: "<index>: <shape> <x> <y> <z> <sx> <sy> <sz> <angle> <color>".
+// Takes the store, mesh keys and color names to write from, as snapshots are written from copies on the I/O thread.
+void write_object(ostream& out, size_t index, const object_store& store, const vector<string>& shape_names,
+                  const vector<string>& color_names) {
+    out << index << ": " << shape_names[store.shapes[index]] << " "
+        << store.positions[index][0] << " "
+        << store.positions[index][1] << " "
+        << store.positions[index][2] << " "
+        << store.scales[index][0] << " "
+        << store.scales[index][1] << " "
+        << store.scales[index][2] << " "
+        << store.angles[index] << " "
+        << color_names[store.colors[index]] << "\n";
+}
+
+// Reads the fields of one object of save data (after its index).
+bool read_object(istream& in, object_record& object) {
+    string shape_type;
+    vec3 position;
+    vec3 scale_vector;
+    float angle;
+    string color;
+
+    in >> shape_type >> position[0] >> position[1] >> position[2] >> scale_vector[0] >> scale_vector[1] >> scale_vector[2] >> angle >> color;
+    if (in.fail()) {
+        return false;
+    }
+
+    int shape_id = find_shape(shape_type);
+    if (shape_id < 0) {
+        cerr << "'" << shape_type << "' is not a valid shape, skipping object" << endl;
+        return false;
+    }
+
+    int color_id = find_color(normalize_color_name(color));
+    if (color_id < 0) {
+        cerr << "Color '" << color << "' not found, using red" << endl;
+        color_id = find_color("red");
+    }
+
+    object.position = position;
+    object.scale = scale_vector;
+    object.angle = angle;
+    object.shape = shape_id;
+    object.color = color_id;
+    return true;
+}
+
 // Function to get RGB values from a color name.
 vector<float> get_color_rgb(string colorName) {
-    colorName = lower_string(colorName);
+    int index = find_color(lower_string(colorName));
 
-    for (const auto& color : colorMap) {
-        if (color.first == colorName) {
-            return color.second;
-        }
+    if (index >= 0) {
+        const vec4& color = ColorPalette[index];
+        return {color[0], color[1], color[2]};
     }
     // Return default color (white) if not found
     return {1.0f, 1.0f, 1.0f};